@@ -0,0 +1,402 @@
+/*
+--------------------------------------------------------------------
+
+bench.c
+
+Simple command-line program that measures how fast each set of
+mixing kernels in the sound code runs on this machine, and checks
+that they all produce the same results.  Then it plays a full set
+of channels through the sound library with one mixing thread, two,
+and so on up to one per CPU, and shows how the mixing load scales.
+
+Usage:  bench [filename.MOD]
+
+--------------------------------------------------------------------
+
+(C) Copyright 1993,1995 Ammon R. Campbell.
+
+I wrote this code for use in my own educational and experimental
+programs, but you may also freely use it in yours as long as you
+abide by the following terms and conditions:
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+  * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+  * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials
+    provided with the distribution.
+  * The name(s) of the author(s) and contributors (if any) may not
+    be used to endorse or promote products derived from this
+    software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.  
+
+--------------------------------------------------------------------
+*/
+
+#define STRICT
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sss.h"
+#include "sss_mix.h"
+
+/* Number of frames in each benchmark block. */
+#define BENCH_FRAMES    4096
+
+/* Number of voices mixed into each block. */
+#define BENCH_VOICES    12
+
+/* Minimum time to run each benchmark, in seconds. */
+#define BENCH_SECONDS   0.5
+
+/* Number of taps in the sinc filter benchmark. */
+#define BENCH_TAPS      SSS_DEFAULT_SINC_TAPS
+
+/* Step through sample data per frame, as 32.32 fixed point;
+** about an 8363 Hz sample played at 44100 Hz. */
+#define BENCH_INCR      0x308C1011ULL
+
+/* Song for the thread benchmark, if none is named. */
+#define BENCH_SONG      "testdata\\neodrink.mod"
+
+/* Time to play each setup in the thread benchmark, in 20 ms polls;
+** the first BENCH_SETTLE of them aren't counted. */
+#define BENCH_POLLS     150
+#define BENCH_SETTLE    25
+
+/* Size of the looping noise sample played in the thread benchmark. */
+#define BENCH_NOISE     8192
+
+/* Kernel sets to try, in order. */
+static const SSS_MIX_KERNELS *kernel_list[] =
+{
+    &sss_mix_scalar,
+    &sss_mix_sse2,
+    &sss_mix_avx2
+};
+
+#define NUM_KERNELS     (sizeof(kernel_list) / sizeof(kernel_list[0]))
+
+static short            src[BENCH_VOICES][BENCH_FRAMES];
+static int              bus[BENCH_FRAMES * 2];
+static int              ref_bus[BENCH_FRAMES * 2];
+static unsigned char    out[BENCH_FRAMES * 2];
+static unsigned char    ref_out[BENCH_FRAMES * 2];
+static short            out16[BENCH_FRAMES * 2];
+static short            ref_out16[BENCH_FRAMES * 2];
+static float            outf[BENCH_FRAMES * 2];
+static float            ref_outf[BENCH_FRAMES * 2];
+static signed char      smp[BENCH_FRAMES + BENCH_TAPS];
+static short            sinc_table[SSS_SINC_PHASES * BENCH_TAPS];
+static short            sinc_out[BENCH_FRAMES];
+static short            ref_sinc_out[BENCH_FRAMES];
+static char             noise[BENCH_NOISE];
+
+/*
+** Returns the current time in seconds.
+*/
+static double now(void)
+{
+    LARGE_INTEGER   count;
+    LARGE_INTEGER   freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+}
+
+/*
+** Mixes one block of all voices with a kernel set.
+*/
+static void mix_block(const SSS_MIX_KERNELS *k, UINT stereo)
+{
+    UINT    v;
+
+    memset(bus, 0, sizeof(bus));
+    for (v = 0; v < BENCH_VOICES; v++)
+    {
+        if (stereo)
+            k->accum_stereo(bus, src[v], BENCH_FRAMES,
+                    SSS_GAIN_UNITY * (v + 1) / (BENCH_VOICES + 1),
+                    SSS_GAIN_UNITY * (BENCH_VOICES - v) / (BENCH_VOICES + 1));
+        else
+            k->accum_mono(bus, src[v], BENCH_FRAMES,
+                    SSS_GAIN_UNITY * (v + 1) / (BENCH_VOICES + 1));
+    }
+}
+
+/*
+** Runs a kernel set's accumulate kernels for a while and
+** returns the number of output frames mixed per second.
+*/
+static double bench_accum(const SSS_MIX_KERNELS *k, UINT stereo)
+{
+    double  start;
+    double  elapsed;
+    long    blocks = 0;
+
+    start = now();
+    do
+    {
+        mix_block(k, stereo);
+        blocks++;
+        elapsed = now() - start;
+    } while (elapsed < BENCH_SECONDS);
+
+    return (double)blocks * BENCH_FRAMES / elapsed;
+}
+
+/*
+** Runs one of a kernel set's output kernels for a while and
+** returns the number of stereo frames packed per second.
+*/
+static double bench_pack(const SSS_MIX_KERNELS *k, UINT bits)
+{
+    double  start;
+    double  elapsed;
+    long    blocks = 0;
+
+    start = now();
+    do
+    {
+        if (bits == 32)
+            k->pack_f32(outf, bus, BENCH_FRAMES * 2);
+        else if (bits == 16)
+            k->pack_s16(out16, bus, BENCH_FRAMES * 2);
+        else
+            k->pack_u8(out, bus, BENCH_FRAMES * 2);
+        blocks++;
+        elapsed = now() - start;
+    } while (elapsed < BENCH_SECONDS);
+
+    return (double)blocks * BENCH_FRAMES / elapsed;
+}
+
+/*
+** Runs a kernel set's sinc resampling kernel for a while and
+** returns the number of frames of all voices resampled
+** per second.
+*/
+static double bench_sinc(const SSS_MIX_KERNELS *k)
+{
+    double  start;
+    double  elapsed;
+    long    blocks = 0;
+    UINT    v;
+
+    start = now();
+    do
+    {
+        for (v = 0; v < BENCH_VOICES; v++)
+        {
+            k->resample_sinc(sinc_out, smp, (ULONGLONG)v << 28, BENCH_INCR,
+                    BENCH_FRAMES, sinc_table, BENCH_TAPS);
+        }
+        blocks++;
+        elapsed = now() - start;
+    } while (elapsed < BENCH_SECONDS);
+
+    return (double)blocks * BENCH_FRAMES / elapsed;
+}
+
+/*
+** Plays a setup through the sound library with some number of
+** mixing threads, and returns the mixing load in tenths of a
+** percent, or zero if it couldn't be played.  The song, if
+** one is given, plays on the music channels; all the other
+** channels are kept busy playing its samples at assorted
+** pitches, or the noise sample if there is no song.
+*/
+static UINT bench_threads(UINT threads, const char *song)
+{
+    UINT    hnoise = SSS_MAX_SAMPLES;
+    UINT    first;
+    UINT    ch;
+    UINT    i;
+    UINT    load;
+
+    sss_set_channels(SSS_MAX_CHANNELS, SSS_MAX_MUSIC_CHANNELS);
+    sss_set_mix_threads(threads, SSS_DEFAULT_MIX_THRESHOLD);
+    sss_set_interpolation(SSS_INTERP_CUBIC);
+    if (sss_init(NULL) != SSSERR_OK)
+        return 0;
+
+    if (song != NULL)
+    {
+        if (sss_music_load_mod((char *)song) != SSSERR_OK)
+        {
+            sss_deinit();
+            return 0;
+        }
+        sss_music_command(SSS_CMD_MUSIC_PLAY);
+    }
+    else
+    {
+        hnoise = sss_sample_add(noise, BENCH_NOISE, 0, BENCH_NOISE,
+                8363, 0);
+    }
+
+    first = sss_get_music_first();
+    for (ch = 0; ch < first; ch++)
+    {
+        sss_channel_pan_set(ch, ch * SSS_PAN_RIGHT / first);
+        sss_channel_volume(ch, SSS_MAX_VOLUME / 4);
+    }
+
+    for (i = 0; i < BENCH_POLLS; i++)
+    {
+        /* Handles that don't name a sample are ignored,
+        ** and tried again with another next time. */
+        for (ch = 0; ch < first; ch++)
+        {
+            if (!sss_channel_is_busy(ch))
+                sss_sample_play(ch,
+                        song != NULL ? (ch + i) % SSS_MAX_SAMPLES : hnoise,
+                        4000 + (ch * 131 + i * 17) % 16000);
+        }
+        Sleep(20);
+
+        /* Don't count getting started. */
+        if (i == BENCH_SETTLE)
+            sss_get_mix_load();
+    }
+    load = sss_get_mix_load();
+
+    sss_deinit();
+    return load;
+}
+
+int main(int argc, char **argv)
+{
+    UINT                    u;
+    UINT                    v;
+    UINT                    stereo;
+    UINT                    same;
+    const SSS_MIX_KERNELS   *k;
+    const char              *song;
+    SYSTEM_INFO             sysinfo;
+    UINT                    cpus;
+    UINT                    load[2];
+    UINT                    load1[2] = { 0, 0 };
+
+    song = (argc > 1) ? argv[1] : BENCH_SONG;
+
+    /* Make up some full scale noise for the voices. */
+    srand(1);
+    for (v = 0; v < BENCH_VOICES; v++)
+    {
+        for (u = 0; u < BENCH_FRAMES; u++)
+            src[v][u] = (short)((rand() & 0xFF) * 256 - 32768);
+    }
+    for (u = 0; u < BENCH_FRAMES + BENCH_TAPS; u++)
+        smp[u] = (signed char)(rand() & 0xFF);
+    for (u = 0; u < SSS_SINC_PHASES * BENCH_TAPS; u++)
+        sinc_table[u] = (short)((rand() & 0x1FFF) - 0x1000);
+    for (u = 0; u < BENCH_NOISE; u++)
+        noise[u] = (char)(rand() & 0xFF);
+
+    printf("Mixing %u voices, %u frames per block.\n",
+            BENCH_VOICES, BENCH_FRAMES);
+    printf("Selected kernels:  %s\n\n", sss_mix_select()->name);
+    printf("Figures are frames per second.\n\n");
+    printf("%-8s %12s %12s %12s %12s %12s %12s  %s\n", "kernels",
+            "mono mix", "stereo mix", "8-bit out", "16-bit out",
+            "float out", "sinc", "matches");
+
+    for (u = 0; u < NUM_KERNELS; u++)
+    {
+        k = kernel_list[u];
+        if (!sss_mix_supported(k))
+        {
+            printf("%-8s not supported\n",
+                    k->name != NULL ? k->name : "(none)");
+            continue;
+        }
+
+        /* Check results against the plain C kernels. */
+        same = 1;
+        for (stereo = 0; stereo < 2; stereo++)
+        {
+            mix_block(&sss_mix_scalar, stereo);
+            memcpy(ref_bus, bus, sizeof(bus));
+            sss_mix_scalar.pack_u8(ref_out, bus, BENCH_FRAMES * 2);
+            sss_mix_scalar.pack_s16(ref_out16, bus, BENCH_FRAMES * 2);
+            sss_mix_scalar.pack_f32(ref_outf, bus, BENCH_FRAMES * 2);
+            mix_block(k, stereo);
+            k->pack_u8(out, bus, BENCH_FRAMES * 2);
+            k->pack_s16(out16, bus, BENCH_FRAMES * 2);
+            k->pack_f32(outf, bus, BENCH_FRAMES * 2);
+            if (memcmp(ref_bus, bus, sizeof(bus)) != 0 ||
+                memcmp(ref_out, out, sizeof(out)) != 0 ||
+                memcmp(ref_out16, out16, sizeof(out16)) != 0 ||
+                memcmp(ref_outf, outf, sizeof(outf)) != 0)
+                same = 0;
+        }
+        sss_mix_scalar.resample_sinc(ref_sinc_out, smp, 0, BENCH_INCR,
+                BENCH_FRAMES, sinc_table, BENCH_TAPS);
+        k->resample_sinc(sinc_out, smp, 0, BENCH_INCR,
+                BENCH_FRAMES, sinc_table, BENCH_TAPS);
+        if (memcmp(ref_sinc_out, sinc_out, sizeof(sinc_out)) != 0)
+            same = 0;
+
+        printf("%-8s %12.0f %12.0f %12.0f %12.0f %12.0f %12.0f  %s\n",
+                k->name,
+                bench_accum(k, 0),
+                bench_accum(k, 1),
+                bench_pack(k, 8),
+                bench_pack(k, 16),
+                bench_pack(k, 32),
+                bench_sinc(k),
+                same ? "yes" : "NO");
+    }
+
+    /* Now see how mixing a full set of channels scales. */
+    GetSystemInfo(&sysinfo);
+    cpus = sysinfo.dwNumberOfProcessors;
+    if (cpus > SSS_MAX_MIX_THREADS)
+        cpus = SSS_MAX_MIX_THREADS;
+    printf("\nMixing %u channels with cubic interpolation, %u CPUs.\n",
+            SSS_MAX_CHANNELS, cpus);
+    printf("Figures are mixing load, percent of playing time.\n\n");
+    printf("%-8s %12s %8s %12s %8s\n", "threads",
+            "noise", "speedup", "song", "speedup");
+
+    for (u = 1; u <= cpus; u++)
+    {
+        load[0] = bench_threads(u, NULL);
+        load[1] = bench_threads(u, song);
+        if (load[0] == 0 || load[1] == 0)
+        {
+            printf("Couldn't play through the sound library.\n");
+            break;
+        }
+        if (u == 1)
+        {
+            load1[0] = load[0];
+            load1[1] = load[1];
+        }
+        printf("%-8u %12.1f %7.2fx %12.1f %7.2fx\n", u,
+                load[0] / 10.0, (double)load1[0] / load[0],
+                load[1] / 10.0, (double)load1[1] / load[1]);
+    }
+
+    return 0;
+}
@@ -55,9 +55,14 @@ DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
 /* Control ID for "About" menu item in system menu of main dialog. */
 #define IDM_ABOUT 12000
 
+/* Message posted to main dialog when a song has been loaded;
+** 'wparam' is the result from the sound library. */
+#define WM_SONGLOADED (WM_APP + 1)
+
 static char my_path[128];               /* App's directory. */
 static HINSTANCE my_instance = NULL;    /* App's instance handle. */
 static char songfile[128];              /* Pathname of song being played. */
+static char loadfile[128];              /* Pathname of song being loaded. */
 
 /* Text to display for "About" window: */
 static char *about_text = "\
@@ -156,6 +161,16 @@ static int get_filename(HWND hwnd, char *fn, char *title)
     return 1;
 }
 
+/*
+** Called by the sound library, on its loading thread, when
+** a song started by sss_music_load_async() has been loaded
+** (or not).  Passes the result on to the main dialog box.
+*/
+static void CALLBACK song_loaded(UINT result, LPVOID param)
+{
+    PostMessage((HWND)param, WM_SONGLOADED, (WPARAM)result, 0);
+}
+
 /*
 ** Message handler for the app's main dialog box.
 */
@@ -241,6 +256,7 @@ INT_PTR DlgPlayProc(HWND hdlg, UINT message, WPARAM wparam, LPARAM lparam)
             {
                 /* Quit */
                 KillTimer(hdlg, 1);
+                sss_music_load_cancel();
                 EndDialog(hdlg, TRUE);
                 return TRUE;
             }
@@ -276,41 +292,59 @@ INT_PTR DlgPlayProc(HWND hdlg, UINT message, WPARAM wparam, LPARAM lparam)
             }
             else if (ctlid == IDB_OPEN)
             {
-                 /* Open a music file. */
+                 /*
+                 ** Open a music file.  It's loaded in the background,
+                 ** and the song playing now carries on until it's
+                 ** ready; see WM_SONGLOADED.
+                 */
                  strcpy_s(stmp, sizeof(stmp), songfile);
                  if (!get_filename(hdlg, stmp, "Open File"))
                      return TRUE;
-                 switch(sss_music_load_mod(stmp))
-                 {
-                     case SSSERR_OK:
-                         strcpy_s(songfile, sizeof(songfile), stmp);
-                         SetDlgItemText(hdlg, IDS_FILENAME, songfile);
-                         sss_music_command(SSS_CMD_MUSIC_PLAY);
-                         break;
-
-                     case SSSERR_NO_MEMORY:
-                         errmsg(hdlg, "Out of memory");
-                         break;
-
-                     case SSSERR_NO_HANDLES:
-                         errmsg(hdlg, "File contains too many instruments");
-                         break;
-
-                     case SSSERR_OPEN_FILE:
-                         errmsg(hdlg, "Failed opening specified file");
-                         break;
-
-                     case SSSERR_READ_FILE:
-                         errmsg(hdlg, "I/O read failure while reading specified file");
-                         break;
-
-                     default:
-                         errmsg(hdlg, "Unable to load specified file");
-                 }
+                 strcpy_s(loadfile, sizeof(loadfile), stmp);
+                 if (sss_music_load_async(loadfile, song_loaded, hdlg) != SSSERR_OK)
+                     errmsg(hdlg, "Unable to load specified file");
+                 else
+                     SetDlgItemText(hdlg, IDS_FILENAME, "Loading...");
                  return TRUE;
             }
             break;
 
+        case WM_SONGLOADED:
+            /* A song has been loaded in the background, or not. */
+            switch ((UINT)wparam)
+            {
+                case SSSERR_OK:
+                    strcpy_s(songfile, sizeof(songfile), loadfile);
+                    SetDlgItemText(hdlg, IDS_FILENAME, songfile);
+                    sss_music_command(SSS_CMD_MUSIC_PLAY);
+                    return TRUE;
+
+                case SSSERR_CANCELLED:
+                    /* Another file was opened in its place. */
+                    return TRUE;
+
+                case SSSERR_NO_MEMORY:
+                    errmsg(hdlg, "Out of memory");
+                    break;
+
+                case SSSERR_NO_HANDLES:
+                    errmsg(hdlg, "File contains too many instruments");
+                    break;
+
+                case SSSERR_OPEN_FILE:
+                    errmsg(hdlg, "Failed opening specified file");
+                    break;
+
+                case SSSERR_READ_FILE:
+                    errmsg(hdlg, "I/O read failure while reading specified file");
+                    break;
+
+                default:
+                    errmsg(hdlg, "Unable to load specified file");
+            }
+            SetDlgItemText(hdlg, IDS_FILENAME, songfile);
+            return TRUE;
+
         case WM_SYSCOMMAND:
             /* A system control (i.e. system menu) was activated. */
             /* ctlwnd = (HWND)lparam; */
@@ -368,6 +402,12 @@ static BOOL init_instance(HINSTANCE hInstance, int nCmdShow)
     ** one here.
     */
 
+    /*
+    ** Music only, with few voices, so we can afford
+    ** the smoothest interpolation.
+    */
+    sss_set_interpolation(SSS_INTERP_CUBIC);
+
     /*
     ** Start the sound library, and complain if
     ** it reports an error.
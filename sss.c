@@ -49,12 +49,15 @@ DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
 #define STRICT
 #include <windows.h>
 #include <mmsystem.h>
+#include <mmreg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h> 
 #include <malloc.h>
+#include <math.h>
 
 #include "sss.h"
+#include "sss_mix.h"
 
 /*
 ** If USE_MM_TIMERS is defined, the code will use Window's
@@ -84,12 +87,115 @@ DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
 //#define BUFFERS_PER_SECOND            3       /* Infrequent jitter. */
 #define BUFFERS_PER_SECOND              2       /* Very clean */
 
+/*
+** SEGMENT_FRAMES:  Longest run of frames that mix() renders in
+** one go.  Segments also end wherever the music has a step
+** due, so notes start on the exact frame.  Keeping segments
+** short keeps the stretch of mixbus being worked on in cache,
+** and bounds how long a song that is started or resumed
+** waits to be heard.
+*/
+#define SEGMENT_FRAMES                  512
+
+/*
+** MAX_PITCHES:  Most different pitches of notes a song may use,
+** since each step of a pattern stores its pitch in a byte.
+*/
+#define MAX_PITCHES     255
+
+/*
+** KEYFRAME_ROWS:  Steps of a song's timeline between the snapshots
+** of its channels kept for seeking.  Seeking replays at most this
+** many steps after the snapshot before the time sought, however
+** long the song is.
+*/
+#define KEYFRAME_ROWS   64
+
+/*
+** MAX_ROWS:  Most steps a song's timeline may have.  Only
+** pattern loops can play a step more than once before the song
+** loops, and loops in several channels at once can multiply;
+** a song that gets this far just ends.
+*/
+#define MAX_ROWS        0x40000
+
+/*
+** MIN_SLIDE_PITCH, MAX_SLIDE_PITCH:  Limits of the pitches that
+** slides go to; the highest and lowest notes a MOD file has.
+*/
+#define MIN_SLIDE_PITCH 113
+#define MAX_SLIDE_PITCH 856
+
+/*
+** NUM_NOTES:  Notes in each row of period_table; three octaves.
+** NO_NOTE:  Stands for a pitch that isn't one of them.
+*/
+#define NUM_NOTES       36
+#define NO_NOTE         0xFF
+
+/*
+** NO_SAMPLE:  Value for the 'sample' field of a packed step,
+** and of how the song stands on a channel, for none given.
+*/
+#define NO_SAMPLE       SSS_NO_SAMPLE
+
+/*
+** START_SPEED, START_BPM:  Ticks in each step of a song, and
+** its beats per minute, until it sets its own.
+*/
+#define START_SPEED     6
+#define START_BPM       125
+
+/*
+** NO_EVENT:  Returned by music_poll() when the music system
+** has nothing scheduled.
+*/
+#define NO_EVENT        0xFFFFFFFF
+
 /*
 ** IDLE:  Value for 'isample' field of channel descriptor to indicate
 ** that no sample is currently playing on that channel.
 */
 #define IDLE            (SSS_MAX_SAMPLES)
 
+/* Number of interpolation modes (SSS_INTERP_...). */
+#define NUM_INTERP      4
+
+/*
+** CUBIC_STEPS:  Number of fractional positions between two
+** sample points that the cubic interpolation table covers.
+*/
+#define CUBIC_STEPS     256
+
+/*
+** SINC_BANDS:  Number of windowed sinc filters built, each for
+** a range of pitch steps.  Band 0 is for steps up to one sample
+** point per frame, and each following band for steps up to
+** twice those of the one before, with its cutoff halved to
+** stop high notes aliasing.
+*/
+#define SINC_BANDS      4
+
+/* SINC_CUTOFF:  Cutoff of the band 0 filter, as a fraction of
+** the sample's Nyquist frequency. */
+#define SINC_CUTOFF     0.9
+
+/* SINC_BETA:  Shape of the Kaiser window applied to the sinc. */
+#define SINC_BETA       7.0
+
+/*
+** SHORT_LOOP:  Loops shorter than this many bytes are unrolled
+** by sss_sample_add() into a copy of at least UNROLLED_LOOP
+** bytes, so the mixer isn't wrapping the loop every few frames.
+*/
+#define SHORT_LOOP      256
+#define UNROLLED_LOOP   2048
+
+/* Output sample formats, for 'out_format'. */
+#define OUTFMT_U8       0       /* Unsigned 8-bit PCM. */
+#define OUTFMT_S16      1       /* Signed 16-bit PCM. */
+#define OUTFMT_F32      2       /* 32-bit IEEE floating point. */
+
 /* Play modes for 'playmode' field of song descriptor. */
 #define PLAYMODE_STOPPED        0
 #define PLAYMODE_PLAYING        1
@@ -104,12 +210,50 @@ typedef struct
 {
     UINT    pan_pos;        /* Current stereo pan position of channel. */
     UINT    isample;        /* Index of playing sample (IDLE for none). */
-    long    vsize;          /* Virtual size of sample at mixing rate. */
-    long    voffset;        /* Current position in sample. */
-    signed char *volume;    /* Pointer to volume table for this channel's
-                            ** current volume setting. */
+    ULONGLONG pos;          /* Current position in sample, as 32.32
+                            ** fixed point (whole bytes in high DWORD). */
+    ULONGLONG incr;         /* Amount added to 'pos' for each sample
+                            ** mixed, as 32.32 fixed point. */
+    UINT    volume;         /* Current volume level of channel,
+                            ** 0..SSS_MAX_VOLUME-1. */
+    int     gain;           /* Mixing gain for mono output, from
+                            ** 'volume'. */
+    int     gain_l;         /* Mixing gains for left and right */
+    int     gain_r;         /* stereo output, from 'volume' and
+                            ** 'pan_pos'. */
+    UINT    interp;         /* Interpolation mode for this channel,
+                            ** or SSS_INTERP_DEFAULT. */
+    UINT    listed;         /* Nonzero if channel is in active[]. */
 } CHANNEL_DESC;
 
+/*
+** Type of the functions that mix one channel into the mix bus.
+** There is one of these for each combination of output channels,
+** looping and interpolation; see voice_renderers[].
+*/
+typedef void (*VOICE_RENDER)(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch);
+
+/* Struct used to describe a thread that helps mix. */
+typedef struct
+{
+    HANDLE  thread;         /* Handle of the thread. */
+    HANDLE  start;          /* Event set to have it mix its share. */
+    HANDLE  done;           /* Event it sets when its share is mixed. */
+    UINT    index;          /* Place in the pool; picks its share. */
+    int     *bus;           /* Alloc'd accumulation buffer of its own. */
+    short   *voicebuf;      /* Alloc'd buffer for resampling. */
+} MIX_WORKER;
+
+/* Struct used to describe a candidate wave output format. */
+typedef struct
+{
+    DWORD   caps_flag;      /* WAVE_FORMAT_... flag in device caps. */
+    DWORD   rate;           /* Sampling rate in Hertz. */
+    WORD    channels;       /* 1 = mono, 2 = stereo. */
+    WORD    bits;           /* Bits per sample, 8 or 16. */
+} OUTPUT_FORMAT_DESC;
+
 /* Struct used to describe a sample. */
 typedef struct
 {
@@ -118,15 +262,77 @@ typedef struct
     UINT    loop_start;     /* Position in sample for looping. */
     UINT    loop_size;      /* How much of sample to repeat (0 if non-looping). */
     UINT    smprate;        /* Rate in Hertz at which data was recorded. */
+    BOOL    owned;          /* TRUE if 'data' was allocated here. */
 } SAMPLE_DESC;
 
+/*
+** Struct used to describe what one channel does in one step of
+** a pattern.  Steps are stored packed, one of these for each
+** channel the song uses, in the song's 'cells' array.
+*/
+typedef struct
+{
+    BYTE    pitch;          /* Index in song's 'pitches' of note
+                            ** to play, or 0 for none. */
+    BYTE    sample;         /* Index of sample in song, or
+                            ** NO_SAMPLE for none given. */
+    BYTE    effect;         /* Type of effect (SSS_EFFECT_...). */
+    BYTE    eparam;         /* Effect parameter. */
+} MUSICCELL_DESC;
+
 /* Struct used to describe one pattern for a song. */
 typedef struct
 {
-    UINT            nsteps; /* Number of steps allocated. */
-    SSS_STEP_DESC   *steps; /* Alloc'd array of step data. */
+    UINT    nsteps;         /* Number of steps allocated. */
+    UINT    first;          /* Index in song's 'cells' of first step. */
 } MUSICPATTERN_DESC;
 
+/*
+** Struct used to describe one step in a song's timeline: the
+** steps in the order they are played, with the jumps and
+** breaks between patterns already followed.
+*/
+typedef struct
+{
+    DWORD   time;           /* When the step plays, in samples
+                            ** from the start of the song. */
+    DWORD   frac;           /* Fraction of a sample after 'time'
+                            ** the step really starts, as 0.32. */
+    WORD    istep;          /* Step in pattern. */
+    BYTE    iorder;         /* Place in order list. */
+    BYTE    ticks;          /* Number of ticks in step; the speed. */
+    BYTE    bpm;            /* Beats per minute. */
+    BYTE    repeats;        /* Extra times the ticks are played,
+                            ** for a pattern delay. */
+} MUSICROW_DESC;
+
+/*
+** Struct used to describe how the song stands on one of its
+** channels, besides what the channel itself is playing:  the
+** note's pitch and volume, and the effect working on it.
+*/
+typedef struct
+{
+    UINT    pitch;          /* Pitch of note, as slid so far. */
+    UINT    sounding;       /* Pitch being played, with any
+                            ** arpeggio or vibrato. */
+    UINT    target;         /* Pitch being slid to. */
+    BYTE    volume;         /* Volume of note, 0..64. */
+    BYTE    effect;         /* Effect in this step (SSS_EFFECT_...). */
+    BYTE    eparam;         /* Effect parameter. */
+    BYTE    slide;          /* Last speed of SLIDE_TO_NOTE. */
+    BYTE    vib_speed;      /* Last speed of vibrato. */
+    BYTE    vib_depth;      /* Last depth of vibrato. */
+    BYTE    vib_pos;        /* Place in vibrato, 0..63. */
+    BYTE    finetune;       /* Row of period_table for the note's
+                            ** sample, 0..15. */
+    BYTE    note;           /* Index in song's 'pitches' of the
+                            ** last note, or 0 for none yet. */
+    BYTE    sample;         /* Index of the last sample given in
+                            ** song, or NO_SAMPLE for none yet. */
+    BYTE    offset;         /* Last SAMPLE_OFFSET param. */
+} MUSICTRACK_DESC;
+
 /* Struct used to describe a song. */
 typedef struct
 {
@@ -134,24 +340,89 @@ typedef struct
     UINT            npatterns;      /* Number of patterns allocated. */
                                     /* Zero if no song is loaded. */
     MUSICPATTERN_DESC *patterns;    /* Alloc'd array of pattern data. */
+    UINT            nchannels;      /* Number of channels in each step. */
+    UINT            ncells;         /* Number of entries in 'cells'. */
+    MUSICCELL_DESC  *cells;         /* Alloc'd steps of all patterns. */
+    UINT            npitches;       /* Number of entries in 'pitches'. */
+    UINT            *pitches;       /* Alloc'd pitches of notes used. */
+    BYTE            *notes;         /* Alloc'd place of each pitch in */
+                                    /* a row of period_table, or */
+                                    /* NO_NOTE if it isn't in one. */
     UINT            norder;         /* Number of entries in pattern order list. */
     UINT            *order;         /* Alloc'd array of pattern play order. */
                                     /* Each specifies an index of a pattern. */
     UINT            nsamples;       /* Number of sample handles. */
     UINT            *samples;       /* Alloc'd array of sample handles. */
-    UINT            pan_pos[SSS_MUSIC_CHANNELS];
+    BYTE            *finetunes;     /* Alloc'd row of period_table for */
+                                    /* each sample, 0..15. */
+    BYTE            *volumes;       /* Alloc'd volume each sample's */
+                                    /* notes start at, 0..64. */
+    UINT            clock;          /* Amiga clock rate for periods. */
+    LPVOID          view;           /* Mapped view of the file the */
+                                    /* samples play from, or NULL. */
+    UINT            pan_pos[SSS_MAX_MUSIC_CHANNELS];
                                     /* Initial pan positons for each channel. */
+    BYTE            pitch_index[SSS_MAX_PERIOD + 1];
+                                    /* Index in 'pitches' of each period */
+                                    /* the notes use, or 0 for those */
+                                    /* they don't, so find_pitch() */
+                                    /* needn't search. */
+
+    /* The timeline of the song, built by music_timeline(). */
+    UINT            nrows;          /* Number of steps in timeline. */
+                                    /* Zero if not built yet. */
+    MUSICROW_DESC   *rows;          /* Alloc'd array of steps. */
+    UINT            loop_row;       /* Step to go back to after the */
+                                    /* last, or nrows if song ends. */
+    DWORD           length;         /* Time when last step is done. */
+    ULONGLONG       loop_length;    /* Time from 'loop_row' to the */
+                                    /* end, as 32.32, or 0 if the */
+                                    /* song ends. */
+    CHANNEL_DESC    *keys;          /* Alloc'd state of the music */
+                                    /* channels before every */
+                                    /* KEYFRAME_ROWS'th step, then */
+                                    /* the same again from */
+                                    /* 'loop_row' on, for the laps */
+                                    /* after the first. */
+    MUSICTRACK_DESC *keytracks;     /* Alloc'd state of the song's */
+                                    /* channels at the same steps. */
+    UINT            nkeys;          /* Number of keyframes for the */
+                                    /* first time through; those */
+                                    /* for later laps follow. */
 
     /* Running status for the song. */
     UINT            playmode;       /* Mode (play/pause/foward/rewind). */
     UINT            iorder;         /* Current place in order list. */
     UINT            ipattern;       /* Current pattern. */
     UINT            istep;          /* Current step in pattern. */
-    DWORD           song_pos;       /* Current position in song (samples). */
-    DWORD           step_delay;     /* Delay between each step (samples). */
-                                    /* Determines tempo. */
+    UINT            irow;           /* Next step in timeline. */
+    UINT            laps;           /* Times the song has looped. */
+    DWORD           lap;            /* Time added to the timeline for */
+                                    /* them; see music_lap(). */
+    DWORD           song_pos;       /* When next step plays (samples). */
+    UINT            crow;           /* Step in timeline now playing. */
+    DWORD           row_lap;        /* 'lap' for that step. */
+    UINT            itick;          /* Next tick of that step. */
+    DWORD           tick_pos;       /* When next tick plays. */
+    MUSICTRACK_DESC tracks[SSS_MAX_MUSIC_CHANNELS];
+                                    /* How each channel stands. */
 } MUSICSONG_DESC;
 
+/* Struct used to describe a load started by sss_music_load_async(). */
+typedef struct
+{
+    char            fn[MAX_PATH];   /* Pathname of file to load. */
+    SSS_LOAD_CALLBACK done;         /* Called when the load is over. */
+    LPVOID          param;          /* Passed to 'done'. */
+    HANDLE          thread;         /* Thread doing the load. */
+    HANDLE          swapped;        /* Set by sss_poll() once the song */
+                                    /* is swapped in, or turned away. */
+    volatile LONG   cancel;         /* Nonzero to give up on the load. */
+    BOOL            taken;          /* TRUE once the song is swapped in. */
+    MUSICSONG_DESC  song;           /* The song being loaded, or after */
+                                    /* the swap, the one it replaced. */
+} LOAD_JOB;
+
 /**************************** DATA ********************************/
 
 /* initialized:  Non-zero if library has been initialized. */
@@ -163,8 +434,40 @@ static UINT mixrate = 0;
 /* is_stereo:  Flag; nonzero if output device supports stereo. */
 static UINT is_stereo = 0;
 
-/* chan:  Array of audio channel descriptors. */
-static CHANNEL_DESC chan[SSS_MAX_CHANNELS];
+/* out_format:  Sample format of output device (OUTFMT_...). */
+static UINT out_format = OUTFMT_U8;
+
+/* chan:  Alloc'd array of audio channel descriptors. */
+static CHANNEL_DESC *chan = NULL;
+
+/* num_channels:  Number of entries in chan[], set by sss_set_channels(). */
+static UINT num_channels = SSS_DEFAULT_CHANNELS;
+
+/* music_channels:  Number of channels at the end of chan[] used
+** for music, set by sss_set_channels(). */
+static UINT music_channels = SSS_MAX_MUSIC_CHANNELS;
+
+/* music_first:  Index of first channel used for music. */
+static UINT music_first = SSS_DEFAULT_CHANNELS - SSS_MAX_MUSIC_CHANNELS;
+
+/*
+** active:  Alloc'd list of the channels that are playing, in no
+** particular order, so mixing only has to visit those.  Channels
+** are added by sss_sample_play() and dropped by mix() once they
+** go idle; 'active_lock' guards changes, since samples may be
+** started from outside the thread that mixes.
+*/
+static UINT *active = NULL;
+static UINT num_active = 0;
+static CRITICAL_SECTION active_lock;
+
+/*
+** music_lock:  Held by sss_poll() for the whole of each buffer
+** it mixes, and by the functions that move the current song
+** and its channels from outside the thread that mixes, so
+** they never change a voice while it is being mixed.
+*/
+static CRITICAL_SECTION music_lock;
 
 /* samples:  Array of sample descriptors. */
 static SAMPLE_DESC samples[SSS_MAX_SAMPLES];
@@ -175,6 +478,10 @@ static HWAVEOUT hwaveout;
 /* bfr_size:  Size of each wave output buffer in bytes. */
 static UINT bfr_size = 0;
 
+/* bfr_frames:  Number of frames (one sample per output channel)
+** in each wave output buffer. */
+static UINT bfr_frames = 0;
+
 /* hbuffers:  Global memory handles of our alloc'd buffers for
 ** audio data in WAVEHDRs. */
 static HGLOBAL hbuffers[2] = { NULL, NULL };
@@ -189,6 +496,82 @@ static WAVEHDR wavehdrs[2];
 ** of output buffers as they are played (0 or 1 depending). */
 static UINT bfr_toggle = 0;
 
+/* mixbus:  Alloc'd accumulation buffer that the channels are mixed
+** into before being converted to the output format; one int per
+** output sample (two per frame in stereo). */
+static int *mixbus = NULL;
+
+/* voicebuf:  Alloc'd buffer holding one channel's sample data,
+** resampled to the mixing rate as 16-bit values, before it is
+** scaled into mixbus.  One short per frame. */
+static short *voicebuf = NULL;
+
+/* mix_threads:  Number of threads to mix with, or 0 for one
+** per CPU; set by sss_set_mix_threads(). */
+static UINT mix_threads = 0;
+
+/* mix_threshold:  Least number of playing channels worth sharing
+** out among the mixing threads; set by sss_set_mix_threads(). */
+static UINT mix_threshold = SSS_DEFAULT_MIX_THRESHOLD;
+
+/*
+** workers:  Pool of threads that help mix, started by sss_init().
+** Entry 0 stands for the thread that runs mix(), which mixes its
+** share straight into mixbus.  The others mix theirs into buses
+** of their own, which mix() adds into mixbus in pool order once
+** the buffer is finished.  The sums are integers, so the result
+** is the same however the channels are shared out.
+*/
+static MIX_WORKER workers[SSS_MAX_MIX_THREADS];
+static UINT num_workers = 1;
+
+/* worker_done:  The 'done' events of workers[1...], for waiting. */
+static HANDLE worker_done[SSS_MAX_MIX_THREADS];
+
+/* workers_quit:  Set to have the workers exit when next started. */
+static volatile LONG workers_quit = 0;
+
+/*
+** The segment being mixed, for the workers: how many entries of
+** active[] to mix, where in the buses the segment starts, how
+** many frames it has, and whether the workers must clear their
+** buses first.
+*/
+static UINT job_voices = 0;
+static UINT job_offset = 0;
+static UINT job_frames = 0;
+static UINT job_clear = 0;
+
+/* load_ticks, load_frames:  Time spent in mix(), in performance
+** counter ticks, and frames mixed, since sss_get_mix_load(). */
+static LONGLONG load_ticks = 0;
+static ULONGLONG load_frames = 0;
+
+/* kernels:  Mixing kernels for this CPU, chosen by sss_init(). */
+static const SSS_MIX_KERNELS *kernels = &sss_mix_scalar;
+
+/* interp_mode:  Interpolation mode for channels that don't have
+** their own setting (SSS_INTERP_...). */
+static UINT interp_mode = SSS_INTERP_NEAREST;
+
+/*
+** Catmull-Rom spline weights for cubic interpolation, for each
+** fractional position between two sample points.  The four
+** weights apply to the sample points before, at, and the two
+** after the position, and are scaled so SSS_GAIN_UNITY is 1.0.
+*/
+static short cubic_table[CUBIC_STEPS][4];
+
+/* sinc_taps:  Number of taps in the windowed sinc filters. */
+static UINT sinc_taps = SSS_DEFAULT_SINC_TAPS;
+
+/*
+** sinc_table:  Alloc'd windowed sinc filters for SSS_INTERP_SINC,
+** built by sss_init().  SINC_BANDS filters, each of which has
+** SSS_SINC_PHASES rows of 'sinc_taps' taps.
+*/
+static short *sinc_table = NULL;
+
 #ifdef USE_MM_TIMERS
 /* timer_id:  Multimedia timer ID, as returned by timeSetEvent() */
 static MMRESULT timer_id = 0xFFFF;
@@ -206,248 +589,2749 @@ static long prof_count_idle_polls = 0;
 /* Current song. */
 static MUSICSONG_DESC song;
 
+/*
+** def_job:  Load that sss_music_create() and the sss_music_define_
+** functions are building a song for, on this thread, or NULL when
+** they work on the current song.  See def_song().
+*/
+static __declspec(thread) LOAD_JOB *def_job = NULL;
+
+/* load_job:  Last load started by sss_music_load_async(), or NULL. */
+static LOAD_JOB *load_job = NULL;
+
+/* pending:  Load whose song is ready for sss_poll() to swap in. */
+static LOAD_JOB * volatile pending = NULL;
+
+/*
+** sample_lock:  Guards finding a free entry in samples[] and
+** claiming it, since a song may be loading on another thread.
+*/
+static CRITICAL_SECTION sample_lock;
+
 /* Number of samples mixed so far. */
 /* Used for timing music. */
 static DWORD song_counter = 0L;
 
 /*
-** Tables for translating sample volumes.
-** The volume of a sample ranges from
-** 0 to 15, and is the primary index into
-** the table.  The secondary index is the
-** signed sample byte to be translated.
+** PCM output formats to try, best first, if floating point
+** output isn't available.  Stereo is preferred over a higher
+** sampling rate, and a higher sampling rate over more bits.
 */
-static signed char volume_tables[SSS_MAX_VOLUME][256];
+static const OUTPUT_FORMAT_DESC pcm_formats[] =
+{
+    { WAVE_FORMAT_4S16, 44100, 2, 16 },
+    { WAVE_FORMAT_4S08, 44100, 2, 8 },
+    { WAVE_FORMAT_2S16, 22050, 2, 16 },
+    { WAVE_FORMAT_2S08, 22050, 2, 8 },
+    { WAVE_FORMAT_1S16, 11025, 2, 16 },
+    { WAVE_FORMAT_1S08, 11025, 2, 8 },
+    { WAVE_FORMAT_4M16, 44100, 1, 16 },
+    { WAVE_FORMAT_4M08, 44100, 1, 8 },
+    { WAVE_FORMAT_2M16, 22050, 1, 16 },
+    { WAVE_FORMAT_2M08, 22050, 1, 8 },
+    { WAVE_FORMAT_1M16, 11025, 1, 16 },
+    { WAVE_FORMAT_1M08, 11025, 1, 8 }
+};
+
+#define NUM_PCM_FORMATS (sizeof(pcm_formats) / sizeof(pcm_formats[0]))
 
 /*
 ** Current volume setting for music playback.
 */
 static UINT music_volume = SSS_MAX_VOLUME * 3 / 4;
 
+/*
+** Periods the Amiga plays the notes of its three octaves at,
+** for each finetune; finetunes 0 to +7 and then -8 to -1, so a
+** MOD file's finetune nibble picks the row.
+*/
+static const WORD period_table[16][NUM_NOTES] =
+{
+    {
+        856, 808, 762, 720, 678, 640, 604, 570, 538, 508, 480, 453,
+        428, 404, 381, 360, 339, 320, 302, 285, 269, 254, 240, 226,
+        214, 202, 190, 180, 170, 160, 151, 143, 135, 127, 120, 113
+    },
+    {
+        850, 802, 757, 715, 674, 637, 601, 567, 535, 505, 477, 450,
+        425, 401, 379, 357, 337, 318, 300, 284, 268, 253, 239, 225,
+        213, 201, 189, 179, 169, 159, 150, 142, 134, 126, 119, 113
+    },
+    {
+        844, 796, 752, 709, 670, 632, 597, 563, 532, 502, 474, 447,
+        422, 398, 376, 355, 335, 316, 298, 282, 266, 251, 237, 224,
+        211, 199, 188, 177, 167, 158, 149, 141, 133, 125, 118, 112
+    },
+    {
+        838, 791, 746, 704, 665, 628, 592, 559, 528, 498, 470, 444,
+        419, 395, 373, 352, 332, 314, 296, 280, 264, 249, 235, 222,
+        209, 198, 187, 176, 166, 157, 148, 140, 132, 125, 118, 111
+    },
+    {
+        832, 785, 741, 699, 660, 623, 588, 555, 524, 495, 467, 441,
+        416, 392, 370, 350, 330, 312, 294, 278, 262, 247, 233, 220,
+        208, 196, 185, 175, 165, 156, 147, 139, 131, 124, 117, 110
+    },
+    {
+        826, 779, 736, 694, 655, 619, 584, 551, 520, 491, 463, 437,
+        413, 390, 368, 347, 328, 309, 292, 276, 260, 245, 232, 219,
+        206, 195, 184, 174, 164, 155, 146, 138, 130, 123, 116, 109
+    },
+    {
+        820, 774, 730, 689, 651, 614, 580, 547, 516, 487, 460, 434,
+        410, 387, 365, 345, 325, 307, 290, 274, 258, 244, 230, 217,
+        205, 193, 183, 172, 163, 154, 145, 137, 129, 122, 115, 109
+    },
+    {
+        814, 768, 725, 684, 646, 610, 575, 543, 513, 484, 457, 431,
+        407, 384, 363, 342, 323, 305, 288, 272, 256, 242, 228, 216,
+        204, 192, 181, 171, 161, 152, 144, 136, 128, 121, 114, 108
+    },
+    {
+        907, 856, 808, 762, 720, 678, 640, 604, 570, 538, 508, 480,
+        453, 428, 404, 381, 360, 339, 320, 302, 285, 269, 254, 240,
+        226, 214, 202, 190, 180, 170, 160, 151, 143, 135, 127, 120
+    },
+    {
+        900, 850, 802, 757, 715, 675, 636, 601, 567, 535, 505, 477,
+        450, 425, 401, 379, 357, 337, 318, 300, 284, 268, 253, 238,
+        225, 212, 200, 189, 179, 169, 159, 150, 142, 134, 126, 119
+    },
+    {
+        894, 844, 796, 752, 709, 670, 632, 597, 563, 532, 502, 474,
+        447, 422, 398, 376, 355, 335, 316, 298, 282, 266, 251, 237,
+        223, 211, 199, 188, 177, 167, 158, 149, 141, 133, 125, 118
+    },
+    {
+        887, 838, 791, 746, 704, 665, 628, 592, 559, 528, 498, 470,
+        444, 419, 395, 373, 352, 332, 314, 296, 280, 264, 249, 235,
+        222, 209, 198, 187, 176, 166, 157, 148, 140, 132, 125, 118
+    },
+    {
+        881, 832, 785, 741, 699, 660, 623, 588, 555, 524, 494, 467,
+        441, 416, 392, 370, 350, 330, 312, 294, 278, 262, 247, 233,
+        220, 208, 196, 185, 175, 165, 156, 147, 139, 131, 123, 117
+    },
+    {
+        875, 826, 779, 736, 694, 655, 619, 584, 551, 520, 491, 463,
+        437, 413, 390, 368, 347, 328, 309, 292, 276, 260, 245, 232,
+        219, 206, 195, 184, 174, 164, 155, 146, 138, 130, 123, 116
+    },
+    {
+        868, 820, 774, 730, 689, 651, 614, 580, 547, 516, 487, 460,
+        434, 410, 387, 365, 345, 325, 307, 290, 274, 258, 244, 230,
+        217, 205, 193, 183, 172, 163, 154, 145, 137, 129, 122, 115
+    },
+    {
+        862, 814, 768, 725, 684, 646, 610, 575, 543, 513, 484, 457,
+        431, 407, 384, 363, 342, 323, 305, 288, 272, 256, 242, 228,
+        216, 203, 192, 181, 171, 161, 152, 144, 136, 128, 121, 114
+    }
+};
+
+/*
+** Step per sample mixed for each Amiga period, as 32.32 fixed
+** point, for the song's clock and the mixing rate.  Built by
+** build_period_table(), so a note only has to look up its step.
+*/
+static ULONGLONG period_incr[SSS_MAX_PERIOD + 1];
+
+/* Clock and mixing rate that period_incr[] was last built for. */
+static UINT period_clock;
+static UINT period_rate;
+
+/*
+** First half of a sine wave, scaled to 0..255, for vibrato;
+** the second half is the same with the sign turned over.
+*/
+static const BYTE vibrato_table[32] =
+{
+      0,  24,  49,  74,  97, 120, 141, 161,
+    180, 197, 212, 224, 235, 244, 250, 253,
+    255, 253, 250, 244, 235, 224, 212, 197,
+    180, 161, 141, 120,  97,  74,  49,  24
+};
+
 /************************* LOCAL FUNCTIONS ************************/
 
 /*
-** music_stop:
-** Stops playback of music.
+** set_gains:
+** Works out the mixing gains of a channel from its volume
+** and pan position.  Called whenever either changes, so the
+** mixing loops only have to apply them.
 **
 ** Parameters:
+**      Name    Description
+**      ----    -----------
+**      pc      Pointer to channel to update.
+**
+** Returns:
 **      NONE
+*/
+static void
+set_gains(CHANNEL_DESC *pc)
+{
+    pc->gain = (int)(pc->volume * SSS_GAIN_UNITY / (SSS_MAX_VOLUME - 1));
+    pc->gain_l = (int)((SSS_PAN_RIGHT - pc->pan_pos) * (UINT)pc->gain /
+                    SSS_PAN_RIGHT);
+    pc->gain_r = (int)(pc->pan_pos * (UINT)pc->gain / SSS_PAN_RIGHT);
+}
+
+/*
+** skip_voice:
+** Steps a channel through a run of frames without mixing it,
+** for channels that can't be heard and for seeking.  Leaves
+** it where it would have been if it had been mixed.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      pc      Pointer to channel.
+**      frames  Number of frames to skip.
 **
 ** Returns:
 **      NONE
 */
 static void
-music_stop(void)
+skip_voice(CHANNEL_DESC *pc, UINT frames)
 {
-    UINT    u;
+    SAMPLE_DESC *psample;
+    ULONGLONG   loop_end;   /* End of sample or loop, as 32.32. */
+    ULONGLONG   loop_len;   /* Length of loop, as 32.32. */
 
-    /* Stop all channels that were used for music. */
-    for (u = 0; u < SSS_MUSIC_CHANNELS; u++)
+    psample = &samples[pc->isample];
+    pc->pos += pc->incr * frames;
+    if (psample->loop_size > 2)
     {
-        sss_channel_stop(SSS_MUSIC_FIRST + u);
+        loop_end = (ULONGLONG)(psample->loop_start + psample->loop_size) << 32;
+        loop_len = (ULONGLONG)psample->loop_size << 32;
+        if (pc->pos >= loop_end)
+            pc->pos = loop_end - loop_len + (pc->pos - loop_end) % loop_len;
+    }
+    else if ((pc->pos >> 32) >= psample->size)
+    {
+        pc->isample = IDLE;
+        pc->pos = 0;
+        pc->incr = 0;
     }
-
-    /* Stop playing the song. */
-    song.playmode = PLAYMODE_STOPPED;
-    song_counter = 0L;
-    song.song_pos = 0L;
 }
 
 /*
-** music_play:
-** Begins playback of music.
+** place_voice:
+** Moves a channel that has just been started to an offset in
+** its sample, for a sample offset.  Offsets past the end of a
+** looping sample wrap round its loop; past the end of any other
+** sample, the channel stops.
 **
 ** Parameters:
-**      NONE
+**      Name    Description
+**      ----    -----------
+**      pc      Pointer to channel.
+**      offset  Offset in sample data, in bytes.
 **
 ** Returns:
 **      NONE
 */
 static void
-music_play(void)
+place_voice(CHANNEL_DESC *pc, UINT offset)
 {
-    UINT u;
+    SAMPLE_DESC *psample;
+    UINT        loop_end;   /* End of sample's loop. */
 
-    /* See if a song is loaded. */
-    if (song.npatterns == 0)
+    if (pc->isample == IDLE)
         return;
-
-    /* If music was paused, rewinding, or fastforwarding, then go
-    ** back to normal playback mode. */
-    if (song.playmode == PLAYMODE_PAUSED ||
-        song.playmode == PLAYMODE_REWINDING ||
-        song.playmode == PLAYMODE_FASTFORWARDING)
+    psample = &samples[pc->isample];
+    if (psample->loop_size > 2)
     {
-        song.playmode = PLAYMODE_PLAYING;
-        return;
+        loop_end = psample->loop_start + psample->loop_size;
+        if (offset >= loop_end)
+            offset = psample->loop_start +
+                     (offset - psample->loop_start) % psample->loop_size;
     }
-
-    /* See if music is already playing. */
-    if (song.playmode == PLAYMODE_PLAYING)
+    else if (offset >= psample->size)
     {
-        /* Already playing. */
+        pc->isample = IDLE;
+        pc->pos = 0;
+        pc->incr = 0;
         return;
     }
+    pc->pos = (ULONGLONG)offset << 32;
+}
 
-    /* If music is already playing, stop it. */
-    music_stop();
+/*
+** pitch_incr:
+** Works out how far to step through the sample data for each
+** sample mixed, to play a sample at a pitch.  Stepping at the
+** recorded rate scaled to the mixing rate plays the sample at
+** its original pitch; the pitch then scales that relative to
+** the recorded rate.  Done in 32.32 fixed point so the mixer
+** only has to add.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      hsmp    Handle of sample, which must be loaded.
+**      pitch   Pitch to play sample at (nonzero).
+**
+** Returns:
+**      Step per sample mixed, as 32.32 fixed point.
+*/
+static ULONGLONG
+pitch_incr(UINT hsmp, UINT pitch)
+{
+    ULONGLONG   incr;
 
-    /* Set initial pan positions for each music channel. */
-    for (u = 0; u < SSS_MUSIC_CHANNELS; u++)
-    {
-        sss_channel_pan_set(SSS_MUSIC_FIRST + u, song.pan_pos[u]);
-    }
+    incr = ((ULONGLONG)samples[hsmp].smprate << 32) / mixrate;
+    return incr * samples[hsmp].smprate / pitch;
+}
 
-    /* Start the music. */
-    song_counter = 0L;
-    song.song_pos = 0L;
-    song.step_delay = ((long)mixrate * (1 + 7)) / 67L;
-    song.iorder = 0;
-    song.ipattern = 0;
-    song.istep = 0;
-    song.playmode = PLAYMODE_PLAYING;
+/*
+** period_step:
+** Looks up how far to step through the sample data for each
+** sample mixed, to play a note at an Amiga period.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      period  Period to play at; anything over SSS_MAX_PERIOD
+**              plays at that.
+**
+** Returns:
+**      Step per sample mixed, as 32.32 fixed point; zero for
+**      period zero.
+*/
+static ULONGLONG
+period_step(UINT period)
+{
+    return period_incr[(period < SSS_MAX_PERIOD) ? period : SSS_MAX_PERIOD];
 }
 
 /*
-** build_volume_tables:
-** Initializes the contents of the volume_tables[]
-** arrays.
+** find_note:
+** Finds where a period falls among the notes of a row of
+** period_table:  the first note that is no lower than it,
+** as the Amiga does for arpeggios.
 **
 ** Parameters:
-**      NONE
+**      Name            Description
+**      ----            -----------
+**      finetune        Row of period_table, 0..15.
+**      period          Period to find.
 **
 ** Returns:
-**      NONE
+**      Index of note in the row, or NUM_NOTES if the period
+**      is higher than all of them.
 */
-static void
-build_volume_tables(void)
+static UINT
+find_note(UINT finetune, UINT period)
 {
-    int             volume;
-    int             pos;
-    int             ival;
-    signed char     cval;
+    const WORD  *periods = period_table[finetune];
+    UINT        lo = 0;
+    UINT        hi = NUM_NOTES;
+    UINT        mid;
 
-    for (volume = 0; volume < SSS_MAX_VOLUME; volume++)
+    /* The periods go down along the row. */
+    while (lo < hi)
     {
-        for (pos = 0; pos < 256; pos++)
-        {
-            ival = pos - 127;
-            ival = ival * volume / 15;
-            cval = (signed char)ival;
-            volume_tables[volume][pos] = cval;
-        }
+        mid = (lo + hi) / 2;
+        if (periods[mid] <= period)
+            hi = mid;
+        else
+            lo = mid + 1;
     }
+    return lo;
 }
 
 /*
-** music_poll:
-** Called periodically by mix().  Determines when to play
-** samples for the currently playing music.
+** start_voice:
+** Starts a sample playing from its beginning on a channel.
+** The channel is left as it was if the sample or step is
+** no good.
 **
 ** Parameters:
 **      Name    Description
 **      ----    -----------
-**      songp   Current song position.
+**      pc      Pointer to channel.
+**      hsmp    Handle of sample to play.
+**      incr    Step per sample mixed, as 32.32 fixed point.
 **
 ** Returns:
 **      NONE
 */
 static void
-music_poll(DWORD songp)
+start_voice(CHANNEL_DESC *pc, UINT hsmp, ULONGLONG incr)
 {
-    UINT            ichannel;
-    SSS_STEP_DESC   *step;
-    UINT            dobreak;
-
-    /* Is a song playing? */
-    if (song.patterns == NULL ||
-            song.playmode == PLAYMODE_PAUSED ||
-            song.playmode == PLAYMODE_STOPPED)
+    /* Check sample number. */
+    if (hsmp >= SSS_MAX_SAMPLES || samples[hsmp].data == NULL || incr == 0)
     {
-        /* No song playing, or song is paused. */
+        /* Bogus sample number. */
         return;
     }
 
-    /* Play any steps whose time has come. */
-    while (song.song_pos < songp && song.playmode != PLAYMODE_STOPPED)
-    {
-        /* Get pattern index for this pattern in play order. */
-        song.ipattern = song.order[song.iorder];
-
-        /* Process notes in this step of the pattern. */
-        step = &song.patterns[song.ipattern].steps[song.istep];
-        dobreak = 0;
-        for (ichannel = 0; ichannel < SSS_MUSIC_CHANNELS; ichannel++)
-        {
-            if (dobreak)
-                break;
+    /* Start the sample playing. */
+    pc->isample = hsmp;
+    pc->pos = 0;
+    pc->incr = incr;
+}
 
-            /* Play a note on this channel? */
-            if (step->note_pitch[ichannel] != 0)
-            {
-                sss_sample_play(SSS_MUSIC_FIRST + ichannel,
-                        song.samples[step->note_sample[ichannel]],
-                        step->note_pitch[ichannel]);
-                sss_channel_volume(SSS_MUSIC_FIRST + ichannel,
-                        music_volume);
-            }
+/*
+** set_volume:
+** Sets the volume level of a channel, and its gains to suit.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      pc      Pointer to channel.
+**      v       Volume level (0..SSS_MAX_VOLUME-1).
+**
+** Returns:
+**      NONE
+*/
+static void
+set_volume(CHANNEL_DESC *pc, UINT v)
+{
+    if (v >= SSS_MAX_VOLUME)
+            v = SSS_MAX_VOLUME - 1;
+    if (v >= 0xFFFE)
+            v = 0;
 
-            /* Have any effect on this channel? */
-            switch(step->note_effect[ichannel])
-            {
-                case SSS_EFFECT_PATTERN_BREAK:
-                    song.istep = 999;
-                    dobreak = 1;
-                    break;
+    pc->volume = v;
+    set_gains(pc);
+}
 
-                case SSS_EFFECT_JUMP:
-                    song.istep = 0;
-                    song.iorder = step->note_eparam[ichannel];
-                    dobreak = 1;
-                    continue;
-                    break;
+/*
+** list_channel:
+** Makes sure the mixer knows about a channel that has
+** been started playing.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      channel Channel number.
+**
+** Returns:
+**      NONE
+*/
+static void
+list_channel(UINT channel)
+{
+    EnterCriticalSection(&active_lock);
+    if (!chan[channel].listed)
+    {
+        chan[channel].listed = 1;
+        active[num_active++] = channel;
+    }
+    LeaveCriticalSection(&active_lock);
+}
+
+/*
+** music_stop:
+** Stops playback of music.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      NONE
+*/
+static void
+music_stop(void)
+{
+    UINT    u;
+
+    /* Stop all channels that were used for music. */
+    for (u = 0; u < music_channels; u++)
+    {
+        sss_channel_stop(music_first + u);
+    }
+
+    /* Stop playing the song. */
+    song.playmode = PLAYMODE_STOPPED;
+    song_counter = 0L;
+    song.song_pos = 0L;
+    song.irow = 0;
+    song.laps = 0;
+    song.lap = 0;
+}
+
+/*
+** def_song:
+** Finds the song that sss_music_create() and the
+** sss_music_define_ functions work on:  the one being
+** loaded, on a thread started by sss_music_load_async(),
+** or else the current song.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Pointer to song.
+*/
+static MUSICSONG_DESC *
+def_song(void)
+{
+    return (def_job != NULL) ? &def_job->song : &song;
+}
+
+/*
+** music_enter, music_leave:
+** Take and give back 'music_lock' around changes to a song,
+** if it's the current song.  A song being loaded on the side
+** is only seen by the thread loading it until it is swapped
+** in, which is done with the lock held.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      psong   Pointer to song.
+**
+** Returns:
+**      NONE
+*/
+static void
+music_enter(MUSICSONG_DESC *psong)
+{
+    if (psong == &song)
+        EnterCriticalSection(&music_lock);
+}
+
+static void
+music_leave(MUSICSONG_DESC *psong)
+{
+    if (psong == &song)
+        LeaveCriticalSection(&music_lock);
+}
+
+/*
+** music_forget:
+** Discards the timeline of a song, so it will be built
+** again with any changes to the song.  Stops the song
+** if it's the current one and it's playing, since it's
+** about to change.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      psong   Pointer to song.
+**
+** Returns:
+**      NONE
+*/
+static void
+music_forget(MUSICSONG_DESC *psong)
+{
+    music_enter(psong);
+    if (psong->rows != NULL)
+    {
+        if (psong == &song)
+            music_stop();
+        free(psong->rows);
+        free(psong->keys);
+        free(psong->keytracks);
+    }
+    psong->rows = NULL;
+    psong->keys = NULL;
+    psong->keytracks = NULL;
+    psong->nkeys = 0;
+    psong->nrows = 0;
+    music_leave(psong);
+}
+
+/*
+** set_pitch:
+** Changes the pitch a channel's note is sounding at, without
+** starting it again.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      pc      Pointer to channel.
+**      pt      Pointer to how the song stands on the channel.
+**      pitch   New pitch.
+**
+** Returns:
+**      NONE
+*/
+static void
+set_pitch(CHANNEL_DESC *pc, MUSICTRACK_DESC *pt, UINT pitch)
+{
+    if (pitch == pt->sounding)
+        return;
+    pt->sounding = pitch;
+    if (pc->isample != IDLE && pitch != 0)
+        pc->incr = period_step(pitch);
+}
+
+/*
+** note_pitch:
+** Works out the pitch of the last note given on a channel.
+** Notes on the Amiga's scale are tuned for the sample.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      pt      Pointer to how the song stands on the channel.
+**
+** Returns:
+**      Pitch of note.
+*/
+static UINT
+note_pitch(const MUSICTRACK_DESC *pt)
+{
+    UINT    note;
+
+    note = song.notes[pt->note];
+    if (note != NO_NOTE)
+        return period_table[pt->finetune][note];
+    return song.pitches[pt->note];
+}
+
+/*
+** start_note:
+** Starts the last note given on a channel playing, from the
+** start of its sample.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      pc      Pointer to channel.
+**      pt      Pointer to how the song stands on the channel.
+**
+** Returns:
+**      NONE
+*/
+static void
+start_note(CHANNEL_DESC *pc, MUSICTRACK_DESC *pt)
+{
+    UINT    pitch;
+
+    pitch = note_pitch(pt);
+    start_voice(pc, song.samples[pt->sample], period_step(pitch));
+    pt->pitch = pitch;
+    pt->sounding = pitch;
+    pt->vib_pos = 0;
+}
+
+/*
+** music_row:
+** Plays one step of the timeline on a set of channels; this
+** is the first tick of the step.  Starts the notes in it,
+** sets the volumes, and sets up the effects for the ticks
+** that follow.  Used both to play the song and to work out
+** how its channels stand at any time, so the two can't
+** disagree.  Jumps, breaks and tempo are already in the
+** timeline.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      voices  Pointer to first of the channels to play on.
+**      tracks  Pointer to how the song stands on each one.
+**      nvoices Number of the song's channels to play.
+**      row     Pointer to step in timeline.
+**
+** Returns:
+**      NONE
+*/
+static void
+music_row(CHANNEL_DESC *voices, MUSICTRACK_DESC *tracks, UINT nvoices,
+        const MUSICROW_DESC *row)
+{
+    UINT            ichannel;
+    UINT            pitch;      /* Note to play, or 0 for none. */
+    CHANNEL_DESC    *pc;
+    MUSICTRACK_DESC *pt;
+    MUSICCELL_DESC  *cell;      /* Step data for a channel. */
+
+    cell = &song.cells[song.patterns[song.order[row->iorder]].first +
+                       row->istep * song.nchannels];
+    for (ichannel = 0; ichannel < nvoices; ichannel++, cell++)
+    {
+        pc = &voices[ichannel];
+        pt = &tracks[ichannel];
+
+        /* A sample given in the step becomes the channel's, for
+        ** this note and the ones after, and sets the volume to
+        ** the sample's, even without a note. */
+        if (cell->sample != NO_SAMPLE)
+        {
+            pt->sample = cell->sample;
+            pt->finetune = song.finetunes[cell->sample];
+            pt->volume = song.volumes[cell->sample];
+        }
+
+        /* Play a note on this channel?  Notes before any sample
+        ** has been given on it are left out.  Sliding to a note
+        ** carries on with the one that is playing, and a delayed
+        ** note waits for its tick. */
+        pitch = (pt->sample != NO_SAMPLE) ? cell->pitch : 0;
+        if (pitch != 0)
+        {
+            pt->note = (BYTE)pitch;
+            if (cell->effect == SSS_EFFECT_SLIDE_TO_NOTE)
+                pt->target = note_pitch(pt);
+            else if (cell->effect != SSS_EFFECT_NOTE_DELAY ||
+                     cell->eparam == 0)
+                start_note(pc, pt);
+        }
+
+        /* Any arpeggio or vibrato in the last step is over. */
+        set_pitch(pc, pt, pt->pitch);
+
+        /* Have any effect on this channel? */
+        pt->effect = cell->effect;
+        pt->eparam = cell->eparam;
+        switch(cell->effect)
+        {
+            case SSS_EFFECT_SET_VOLUME:
+                pt->volume = (BYTE)((cell->eparam < SSS_MAX_VOLUME) ?
+                        cell->eparam : SSS_MAX_VOLUME - 1);
+                break;
+
+            case SSS_EFFECT_SLIDE_TO_NOTE:
+                if (cell->eparam != 0)
+                    pt->slide = cell->eparam;
+                break;
+
+            case SSS_EFFECT_VIBRATO:
+                if (cell->eparam >> 4)
+                    pt->vib_speed = (BYTE)(cell->eparam >> 4);
+                if (cell->eparam & 0x0F)
+                    pt->vib_depth = (BYTE)(cell->eparam & 0x0F);
+                break;
+
+            case SSS_EFFECT_SAMPLE_OFFSET:
+                /* Zero starts at the last offset used. */
+                if (cell->eparam != 0)
+                    pt->offset = cell->eparam;
+                if (pitch != 0)
+                    place_voice(pc, (UINT)pt->offset << 8);
+                break;
+
+            case SSS_EFFECT_NOTE_CUT:
+                if (cell->eparam == 0)
+                    pt->volume = 0;
+                break;
+
+            case SSS_EFFECT_NOTE_DELAY:
+                /* Without a note there is nothing to delay. */
+                if (pitch == 0)
+                    pt->effect = SSS_EFFECT_NONE;
+                break;
+
+            case SSS_EFFECT_RETRIGGER:
+                /* A note in the step has just been started. */
+                if (pitch == 0 && cell->eparam != 0 && pt->note != 0)
+                    start_voice(pc, song.samples[pt->sample],
+                            period_step(pt->sounding));
+                break;
+
+            default:
+                    ; /* Nothing to do until the next tick. */
+        }
+
+        if (pitch != 0 || cell->sample != NO_SAMPLE ||
+                cell->effect == SSS_EFFECT_SET_VOLUME ||
+                cell->effect == SSS_EFFECT_NOTE_CUT)
+            set_volume(pc, pt->volume * music_volume / (SSS_MAX_VOLUME - 1));
+    }
+}
+
+/*
+** music_tick:
+** Plays one of the ticks after the first in a step of the
+** timeline on a set of channels, moving along the effects
+** that work tick by tick.  Only uses the tables and a few
+** sums for each channel, besides starting delayed and
+** retriggered notes.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      voices  Pointer to first of the channels to play on.
+**      tracks  Pointer to how the song stands on each one.
+**      nvoices Number of the song's channels to play.
+**      tick    Tick in step; counts from 0 again each time a
+**              pattern delay plays the ticks again.
+**
+** Returns:
+**      NONE
+*/
+static void
+music_tick(CHANNEL_DESC *voices, MUSICTRACK_DESC *tracks, UINT nvoices,
+        UINT tick)
+{
+    UINT            ichannel;
+    UINT            n;
+    UINT            note;
+    UINT            depth;
+    CHANNEL_DESC    *pc;
+    MUSICTRACK_DESC *pt;
+
+    for (ichannel = 0; ichannel < nvoices; ichannel++)
+    {
+        pc = &voices[ichannel];
+        pt = &tracks[ichannel];
+        switch (pt->effect)
+        {
+            case SSS_EFFECT_ARPEGGIO:
+                n = tick % 3;
+                note = find_note(pt->finetune, pt->pitch);
+                if (n == 0 || note == NUM_NOTES)
+                {
+                    set_pitch(pc, pt, pt->pitch);
+                    break;
+                }
+                note += (n == 1) ? (pt->eparam >> 4) : (pt->eparam & 0x0F);
+                set_pitch(pc, pt, period_table[pt->finetune]
+                        [(note < NUM_NOTES) ? note : NUM_NOTES - 1]);
+                break;
+
+            case SSS_EFFECT_SLIDE_UP:
+                n = pt->eparam;
+                pt->pitch = (pt->pitch > MIN_SLIDE_PITCH + n) ?
+                        pt->pitch - n : MIN_SLIDE_PITCH;
+                set_pitch(pc, pt, pt->pitch);
+                break;
+
+            case SSS_EFFECT_SLIDE_DOWN:
+                n = pt->eparam;
+                pt->pitch = (pt->pitch + n < MAX_SLIDE_PITCH) ?
+                        pt->pitch + n : MAX_SLIDE_PITCH;
+                set_pitch(pc, pt, pt->pitch);
+                break;
+
+            case SSS_EFFECT_SLIDE_TO_NOTE:
+                n = pt->slide;
+                if (pt->target == 0)
+                    break;
+                if (pt->pitch < pt->target)
+                    pt->pitch = (pt->pitch + n < pt->target) ?
+                            pt->pitch + n : pt->target;
+                else
+                    pt->pitch = (pt->pitch > pt->target + n) ?
+                            pt->pitch - n : pt->target;
+                set_pitch(pc, pt, pt->pitch);
+                break;
+
+            case SSS_EFFECT_VIBRATO:
+                depth = vibrato_table[pt->vib_pos & 31] * pt->vib_depth / 128;
+                if (pt->vib_pos & 32)
+                    set_pitch(pc, pt, (pt->pitch > depth) ?
+                            pt->pitch - depth : pt->pitch);
+                else
+                    set_pitch(pc, pt, pt->pitch + depth);
+                pt->vib_pos = (BYTE)((pt->vib_pos + pt->vib_speed) & 63);
+                break;
+
+            case SSS_EFFECT_NOTE_CUT:
+                if (tick == pt->eparam)
+                {
+                    pt->volume = 0;
+                    set_volume(pc, 0);
+                }
+                break;
+
+            case SSS_EFFECT_NOTE_DELAY:
+                if (tick == pt->eparam)
+                {
+                    start_note(pc, pt);
+                    set_volume(pc, pt->volume * music_volume /
+                            (SSS_MAX_VOLUME - 1));
+                }
+                break;
+
+            case SSS_EFFECT_RETRIGGER:
+                if (pt->eparam != 0 && tick % pt->eparam == 0 &&
+                        pt->note != 0)
+                    start_voice(pc, song.samples[pt->sample],
+                            period_step(pt->sounding));
+                break;
+
+            case SSS_EFFECT_VOLUME_SLIDE:
+                n = pt->volume;
+                if (pt->eparam >> 4)
+                    n += pt->eparam >> 4;
+                else
+                    n = (n > (UINT)(pt->eparam & 0x0F)) ?
+                            n - (pt->eparam & 0x0F) : 0;
+                if (n >= SSS_MAX_VOLUME)
+                    n = SSS_MAX_VOLUME - 1;
+                pt->volume = (BYTE)n;
+                set_volume(pc, n * music_volume / (SSS_MAX_VOLUME - 1));
+                break;
+
+            default:
+                    ; /* Do nothing. */
+        }
+    }
+}
+
+/*
+** music_skip:
+** Steps a set of channels through a run of frames without
+** mixing them.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      voices  Pointer to first channel.
+**      nvoices Number of channels.
+**      frames  Number of frames to skip.
+**
+** Returns:
+**      NONE
+*/
+static void
+music_skip(CHANNEL_DESC *voices, UINT nvoices, DWORD frames)
+{
+    UINT    u;
+
+    for (u = 0; u < nvoices; u++)
+    {
+        if (voices[u].isample != IDLE)
+            skip_voice(&voices[u], frames);
+    }
+}
+
+/*
+** tick_length:
+** Works out how long a tick lasts at a tempo:  2.5/bpm
+** seconds, kept to a fraction of a sample so that times
+** added up from it don't drift, however long a song plays
+** and whatever the mixing rate.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      bpm     Beats per minute (nonzero).
+**
+** Returns:
+**      Length of tick in samples, as 32.32 fixed point.
+*/
+static ULONGLONG
+tick_length(UINT bpm)
+{
+    return ((ULONGLONG)mixrate * 5 << 31) / bpm;
+}
+
+/*
+** row_ticks:
+** Works out how many ticks a step of the timeline lasts,
+** counting those a pattern delay adds.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      row     Pointer to step in timeline.
+**
+** Returns:
+**      Number of ticks.
+*/
+static UINT
+row_ticks(const MUSICROW_DESC *row)
+{
+    return (UINT)row->ticks * (1 + row->repeats);
+}
+
+/*
+** music_tick_time:
+** Works out when a tick of a step in the timeline plays.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      irow    Step in timeline.
+**      tick    Tick in step; the number of ticks in the step
+**              gives when the step is done.
+**
+** Returns:
+**      Time of tick, in samples from the start of the song.
+*/
+static DWORD
+music_tick_time(UINT irow, UINT tick)
+{
+    const MUSICROW_DESC *row = &song.rows[irow];
+
+    return row->time +
+           (DWORD)((row->frac + tick * tick_length(row->bpm)) >> 32);
+}
+
+/*
+** music_replay:
+** Plays a step of the timeline and its ticks on a set of
+** channels without mixing them, up to a given time.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      voices  Pointer to first of the channels to play on.
+**      tracks  Pointer to how the song stands on each one.
+**      nvoices Number of the song's channels to play.
+**      irow    Step in timeline.
+**      end     Time to stop at; no later than the next step.
+**
+** Returns:
+**      Next tick of the step to play after 'end'.
+*/
+static UINT
+music_replay(CHANNEL_DESC *voices, MUSICTRACK_DESC *tracks, UINT nvoices,
+        UINT irow, DWORD end)
+{
+    UINT    tick;
+    DWORD   time;       /* Time channels have got to. */
+    DWORD   next;       /* Time of next tick. */
+
+    music_row(voices, tracks, nvoices, &song.rows[irow]);
+    time = song.rows[irow].time;
+    for (tick = 1; tick < row_ticks(&song.rows[irow]); tick++)
+    {
+        next = music_tick_time(irow, tick);
+        if (next > end)
+            break;
+        music_skip(voices, nvoices, next - time);
+        time = next;
+        music_tick(voices, tracks, nvoices, tick % song.rows[irow].ticks);
+    }
+    music_skip(voices, nvoices, end - time);
+    return tick;
+}
+
+/*
+** music_lap:
+** Works out how much later the timeline is played after the
+** song has looped a number of times.  Worked out afresh from
+** the exact length of the loop each time, so it doesn't drift.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      laps    Times the song has looped.
+**
+** Returns:
+**      Time added to the timeline, in samples.
+*/
+static DWORD
+music_lap(UINT laps)
+{
+    return (DWORD)(song.loop_length >> 32) * laps +
+           (DWORD)(((song.loop_length & 0xFFFFFFFF) * laps) >> 32);
+}
+
+/*
+** music_next:
+** Moves the current song on to the next step in its timeline,
+** going round again if the song loops.  Past the last step of
+** a song that ends, 'irow' is left at 'nrows' and 'song_pos'
+** at the time the song is over.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      NONE
+*/
+static void
+music_next(void)
+{
+    song.irow++;
+    if (song.irow >= song.nrows && song.loop_row < song.nrows)
+    {
+        song.laps++;
+        song.lap = music_lap(song.laps);
+        song.irow = song.loop_row;
+    }
+
+    if (song.irow < song.nrows)
+        song.song_pos = song.rows[song.irow].time + song.lap;
+    else
+        song.song_pos = song.length + song.lap;
+}
+
+/*
+** music_keyframes:
+** Goes through the timeline of the current song without
+** mixing anything, noting how the music channels stand
+** before every KEYFRAME_ROWS'th step: which samples are
+** sounding, how far into them, how fast and how loud, and
+** what the effects on them are up to.  The song's own
+** position is all in the timeline, so this is all
+** music_locate() needs to pick up anywhere in the song
+** after replaying only a few steps.  A song that loops
+** comes back to its loop with whatever is still sounding
+** from its end, so the part that loops is played through
+** a second time from there, with keyframes of its own for
+** the laps after the first.  Done once, the first time the
+** song is played or sought in; the timeline must have been
+** built.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      1       Keyframes are ready.
+**      0       Out of memory.
+*/
+static UINT
+music_keyframes(void)
+{
+    UINT            nkeys;      /* Snapshots of first time through. */
+    UINT            nlaps;      /* Snapshots of the later laps. */
+    UINT            nvoices;    /* Channels in song used for music. */
+    UINT            irow;
+    UINT            u;
+    DWORD           end;        /* When step is done. */
+    CHANNEL_DESC    *voices;    /* Channels played through song. */
+    MUSICTRACK_DESC *tracks;    /* How the song stands on them. */
+
+    if (song.keys != NULL)
+        return 1;
+
+    nvoices = song.nchannels;
+    if (nvoices > music_channels)
+        nvoices = music_channels;
+
+    nkeys = (song.nrows + KEYFRAME_ROWS - 1) / KEYFRAME_ROWS;
+    nlaps = 0;
+    if (song.loop_row < song.nrows)
+        nlaps = (song.nrows - song.loop_row + KEYFRAME_ROWS - 1) /
+                KEYFRAME_ROWS;
+
+    /* One more set of channels to play through the song with. */
+    song.keys = malloc(sizeof(CHANNEL_DESC) * nvoices * (nkeys + nlaps + 1));
+    song.keytracks = malloc(sizeof(MUSICTRACK_DESC) * nvoices *
+            (nkeys + nlaps + 1));
+    if (song.keys == NULL || song.keytracks == NULL)
+    {
+        free(song.keys);
+        free(song.keytracks);
+        song.keys = NULL;
+        song.keytracks = NULL;
+        return 0;
+    }
+
+    /* Nothing is playing when the song starts. */
+    voices = song.keys + nvoices * (nkeys + nlaps);
+    tracks = song.keytracks + nvoices * (nkeys + nlaps);
+    memset(voices, 0, sizeof(CHANNEL_DESC) * nvoices);
+    memset(tracks, 0, sizeof(MUSICTRACK_DESC) * nvoices);
+    for (u = 0; u < nvoices; u++)
+    {
+        voices[u].pan_pos = song.pan_pos[u];
+        voices[u].isample = IDLE;
+        voices[u].interp = SSS_INTERP_DEFAULT;
+        set_volume(&voices[u], music_volume);
+        tracks[u].volume = SSS_MAX_VOLUME - 1;
+        tracks[u].sample = NO_SAMPLE;
+    }
+
+    /* Play through the song, taking a snapshot every
+    ** KEYFRAME_ROWS steps. */
+    for (irow = 0; irow < song.nrows; irow++)
+    {
+        if (irow % KEYFRAME_ROWS == 0)
+        {
+            memcpy(song.keys + nvoices * (irow / KEYFRAME_ROWS), voices,
+                    sizeof(CHANNEL_DESC) * nvoices);
+            memcpy(song.keytracks + nvoices * (irow / KEYFRAME_ROWS), tracks,
+                    sizeof(MUSICTRACK_DESC) * nvoices);
+        }
+
+        end = (irow + 1 < song.nrows) ?
+                song.rows[irow + 1].time : song.length;
+        music_replay(voices, tracks, nvoices, irow, end);
+    }
+
+    /* Go round the loop once more, from the moment the song
+    ** wraps back to it, taking a snapshot every KEYFRAME_ROWS
+    ** steps from 'loop_row'. */
+    for (irow = song.loop_row; irow < song.nrows; irow++)
+    {
+        if ((irow - song.loop_row) % KEYFRAME_ROWS == 0)
+        {
+            u = nkeys + (irow - song.loop_row) / KEYFRAME_ROWS;
+            memcpy(song.keys + nvoices * u, voices,
+                    sizeof(CHANNEL_DESC) * nvoices);
+            memcpy(song.keytracks + nvoices * u, tracks,
+                    sizeof(MUSICTRACK_DESC) * nvoices);
+        }
+
+        end = (irow + 1 < song.nrows) ?
+                song.rows[irow + 1].time : song.length;
+        music_replay(voices, tracks, nvoices, irow, end);
+    }
+
+    song.nkeys = nkeys;
+    return 1;
+}
+
+/*
+** music_timeline:
+** Builds the timeline of the current song, if it hasn't
+** been built yet, by stepping through the song the way it
+** will be played.  Each step gets the time it will be
+** played at and the number of ticks in it, and position
+** jumps, pattern breaks and tempo changes are all worked
+** out here, so playing and seeking need only follow the
+** timeline.  Pattern loops and pattern delays are worked
+** out here too.  If the song comes back to a step it has
+** already played, other than by a pattern loop, it loops
+** from there.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      1       Timeline is ready.
+**      0       No song, or out of memory.
+*/
+static UINT
+music_timeline(void)
+{
+    UINT            *base;      /* First entry in 'seen' for each order. */
+    UINT            *seen;      /* Timeline step of each step in order
+                                ** list, or NO_EVENT if not played. */
+    UINT            nseen;      /* Number of entries in 'seen'. */
+    UINT            iorder;
+    UINT            istep;
+    UINT            ichannel;
+    UINT            nchannels;  /* Channels in song used for music. */
+    UINT            jump;       /* Order to jump to, or NO_EVENT. */
+    UINT            brk;        /* Step to break to, or NO_EVENT. */
+    UINT            back;       /* Step a pattern loop goes back */
+                                /* to, or NO_EVENT. */
+    UINT            loop_start[SSS_MAX_MUSIC_CHANNELS];
+                                /* Step each channel's pattern */
+                                /* loop goes back to. */
+    UINT            loop_count[SSS_MAX_MUSIC_CHANNELS];
+                                /* Times each channel's pattern */
+                                /* loop has yet to go back. */
+    UINT            repeats;    /* Extra times step is played. */
+    UINT            nalloc;     /* Entries allocated in 'rows'. */
+    UINT            speed;      /* Ticks in each step. */
+    UINT            bpm;        /* Beats per minute. */
+    ULONGLONG       time;       /* Time of step, as 32.32 samples. */
+    MUSICPATTERN_DESC *pattern;
+    MUSICCELL_DESC  *cell;
+    MUSICROW_DESC   *rows;
+    MUSICROW_DESC   *more;
+
+    if (song.nrows != 0)
+        return 1;
+    if (song.npatterns == 0 || song.norder == 0)
+        return 0;
+
+    /* Find room to note which steps have been played, and for
+    ** the timeline; there is a step in it for each, unless
+    ** there are pattern loops. */
+    base = malloc(sizeof(UINT) * song.norder);
+    if (base == NULL)
+        return 0;
+    nseen = 0;
+    for (iorder = 0; iorder < song.norder; iorder++)
+    {
+        base[iorder] = nseen;
+        nseen += song.patterns[song.order[iorder]].nsteps;
+    }
+    nalloc = nseen + 1;
+    seen = malloc(sizeof(UINT) * (nseen + 1));
+    rows = malloc(sizeof(MUSICROW_DESC) * nalloc);
+    if (seen == NULL || rows == NULL)
+    {
+        free(base);
+        free(seen);
+        free(rows);
+        return 0;
+    }
+    memset(seen, 0xFF, sizeof(UINT) * (nseen + 1));
+
+    nchannels = song.nchannels;
+    if (nchannels > music_channels)
+        nchannels = music_channels;
+
+    song.nrows = 0;
+    song.loop_row = NO_EVENT;
+    time = 0;
+    speed = START_SPEED;
+    bpm = START_BPM;
+    memset(loop_start, 0, sizeof(loop_start));
+    memset(loop_count, 0, sizeof(loop_count));
+    iorder = 0;
+    istep = 0;
+    while (iorder < song.norder && song.nrows < MAX_ROWS)
+    {
+        /* Past the end of this pattern? */
+        pattern = &song.patterns[song.order[iorder]];
+        if (istep >= pattern->nsteps)
+        {
+            iorder++;
+            istep = 0;
+            memset(loop_start, 0, sizeof(loop_start));
+            memset(loop_count, 0, sizeof(loop_count));
+            continue;
+        }
+
+        /* Played this step already?  Then the song loops. */
+        if (seen[base[iorder] + istep] != NO_EVENT)
+        {
+            song.loop_row = seen[base[iorder] + istep];
+            break;
+        }
+        seen[base[iorder] + istep] = song.nrows;
+
+        /* Add the step to the timeline. */
+        if (song.nrows >= nalloc)
+        {
+            nalloc *= 2;
+            more = realloc(rows, sizeof(MUSICROW_DESC) * nalloc);
+            if (more == NULL)
+            {
+                free(base);
+                free(seen);
+                free(rows);
+                song.nrows = 0;
+                return 0;
+            }
+            rows = more;
+        }
+        rows[song.nrows].time = (DWORD)(time >> 32);
+        rows[song.nrows].frac = (DWORD)time;
+        rows[song.nrows].iorder = (BYTE)iorder;
+        rows[song.nrows].istep = (WORD)istep;
+        song.nrows++;
+
+        /* Look for effects that change where or when the
+        ** next step is played. */
+        jump = NO_EVENT;
+        brk = NO_EVENT;
+        back = NO_EVENT;
+        repeats = 0;
+        cell = &song.cells[pattern->first + istep * song.nchannels];
+        for (ichannel = 0; ichannel < nchannels; ichannel++, cell++)
+        {
+            switch (cell->effect)
+            {
+                case SSS_EFFECT_PATTERN_BREAK:
+                    brk = cell->eparam;
+                    break;
+
+                case SSS_EFFECT_JUMP:
+                    jump = cell->eparam;
+                    break;
+
+                case SSS_EFFECT_SET_TEMPO:
+                    if (cell->eparam >= SSS_MIN_BPM)
+                        bpm = cell->eparam;
+                    else if (cell->eparam != 0)
+                        speed = cell->eparam;
+                    break;
+
+                case SSS_EFFECT_PATTERN_LOOP:
+                    /* Zero marks where the loop starts; otherwise
+                    ** go back that many times, then carry on. */
+                    if (cell->eparam == 0)
+                    {
+                        loop_start[ichannel] = istep;
+                    }
+                    else if (loop_count[ichannel] == 0)
+                    {
+                        loop_count[ichannel] = cell->eparam;
+                        back = loop_start[ichannel];
+                    }
+                    else if (--loop_count[ichannel] != 0)
+                    {
+                        back = loop_start[ichannel];
+                    }
+                    break;
+
+                case SSS_EFFECT_PATTERN_DELAY:
+                    if (cell->eparam != 0)
+                        repeats = cell->eparam;
+                    break;
+            }
+        }
+        rows[song.nrows - 1].ticks = (BYTE)speed;
+        rows[song.nrows - 1].bpm = (BYTE)bpm;
+        rows[song.nrows - 1].repeats = (BYTE)repeats;
+        time += speed * (1 + repeats) * tick_length(bpm);
+
+        /* On to the next step. */
+        if (jump != NO_EVENT || brk != NO_EVENT)
+        {
+            iorder = (jump != NO_EVENT) ? jump : iorder + 1;
+            istep = (brk != NO_EVENT) ? brk : 0;
+            memset(loop_start, 0, sizeof(loop_start));
+            memset(loop_count, 0, sizeof(loop_count));
+
+            /* Breaks past the end of a pattern go to its start. */
+            if (iorder < song.norder &&
+                istep >= song.patterns[song.order[iorder]].nsteps)
+                istep = 0;
+        }
+        else if (back != NO_EVENT)
+        {
+            /* The steps looped over are played again, without
+            ** that making the song loop. */
+            while (istep > back)
+                seen[base[iorder] + istep--] = NO_EVENT;
+            seen[base[iorder] + istep] = NO_EVENT;
+        }
+        else
+        {
+            istep++;
+        }
+    }
+    song.loop_length = 0;
+    if (song.loop_row == NO_EVENT)
+        song.loop_row = song.nrows;
+    else
+        song.loop_length = time - (((ULONGLONG)rows[song.loop_row].time << 32) |
+                                   rows[song.loop_row].frac);
+    song.length = (DWORD)(time >> 32);
+
+    free(base);
+    free(seen);
+
+    /* A song with no steps at all has nothing to play. */
+    if (song.nrows == 0)
+    {
+        free(rows);
+        return 0;
+    }
+    song.rows = realloc(rows, sizeof(MUSICROW_DESC) * song.nrows);
+    if (song.rows == NULL)
+        song.rows = rows;
+    return 1;
+}
+
+/*
+** music_locate:
+** Moves the current song to a time in its timeline, leaving
+** the music channels as they would be at that time if the
+** song had been playing all along: the channels are set from
+** the keyframe before it, for the lap of the song it is in,
+** and the few steps in between are replayed without mixing.
+** The next tick or step is played when its time comes.  The
+** timeline and keyframes must have been built, and
+** 'music_lock' must be held.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      t       Time from start of song, in samples.
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      1       Successful.
+**      0       The song has ended by then.
+*/
+static UINT
+music_locate(DWORD t)
+{
+    UINT            laps;       /* Times the song has looped. */
+    DWORD           lap;        /* Time added for them. */
+    DWORD           since;      /* Time since the part that loops */
+                                /* was first played. */
+    UINT            lo;
+    UINT            hi;
+    UINT            mid;
+    UINT            irow;
+    UINT            first;      /* Step the keyframe is taken at. */
+    UINT            ikey;       /* Index of keyframe. */
+    UINT            u;
+    UINT            nvoices;    /* Channels in song used for music. */
+    CHANNEL_DESC    *key;       /* Keyframe to start from. */
+    CHANNEL_DESC    *voices;    /* The music channels. */
+
+    /* Past the end?  Songs that loop keep going round; count
+    ** the laps begun by then, as music_next() would. */
+    if (t >= song.length && song.loop_row >= song.nrows)
+        return 0;
+    laps = 0;
+    if (song.loop_row < song.nrows)
+    {
+        since = t - song.rows[song.loop_row].time;
+        if (t >= song.rows[song.loop_row].time && music_lap(1) <= since)
+        {
+            laps = (UINT)(((ULONGLONG)since << 32) / song.loop_length);
+            while (music_lap(laps + 1) <= since)
+                laps++;
+            while (music_lap(laps) > since)
+                laps--;
+        }
+    }
+    lap = music_lap(laps);
+    t -= lap;
+
+    /* Find the last step that starts by then. */
+    lo = 0;
+    hi = song.nrows;
+    while (hi - lo > 1)
+    {
+        mid = (lo + hi) / 2;
+        if (song.rows[mid].time <= t)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    nvoices = song.nchannels;
+    if (nvoices > music_channels)
+        nvoices = music_channels;
+
+    /* Laps after the first have keyframes of their own, from
+    ** the step the song loops back to. */
+    if (laps == 0)
+    {
+        first = lo - lo % KEYFRAME_ROWS;
+        ikey = lo / KEYFRAME_ROWS;
+    }
+    else
+    {
+        first = lo - (lo - song.loop_row) % KEYFRAME_ROWS;
+        ikey = song.nkeys + (lo - song.loop_row) / KEYFRAME_ROWS;
+    }
+
+    /* Set the channels as they were at the keyframe... */
+    voices = &chan[music_first];
+    key = &song.keys[ikey * nvoices];
+    for (u = 0; u < nvoices; u++)
+    {
+        voices[u].isample = key[u].isample;
+        voices[u].pos = key[u].pos;
+        voices[u].incr = key[u].incr;
+        set_volume(&voices[u], key[u].volume);
+    }
+    memcpy(song.tracks, &song.keytracks[ikey * nvoices],
+            sizeof(MUSICTRACK_DESC) * nvoices);
+    for (u = nvoices; u < music_channels; u++)
+    {
+        sss_channel_stop(music_first + u);
+    }
+
+    /* ...then play on from there to the time wanted. */
+    for (irow = first; irow < lo; irow++)
+    {
+        music_replay(voices, song.tracks, nvoices, irow,
+                song.rows[irow + 1].time);
+    }
+    song.itick = music_replay(voices, song.tracks, nvoices, lo, t);
+    for (u = 0; u < nvoices; u++)
+    {
+        if (voices[u].isample != IDLE)
+            list_channel(music_first + u);
+    }
+
+    /* The next tick or step is the one after. */
+    song.crow = lo;
+    song.row_lap = lap;
+    song.tick_pos = music_tick_time(lo, song.itick) + lap;
+    song.irow = lo;
+    song.laps = laps;
+    song.lap = lap;
+    song.iorder = song.rows[lo].iorder;
+    song.ipattern = song.order[song.iorder];
+    song.istep = song.rows[lo].istep;
+    music_next();
+    return 1;
+}
+
+/*
+** music_play:
+** Begins playback of music.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      NONE
+*/
+static void
+music_play(void)
+{
+    UINT    u;
+    DWORD   from;       /* Where to start playing, in samples. */
+
+    /* See if a song is loaded. */
+    if (song.npatterns == 0)
+        return;
+
+    /* See if music is already playing. */
+    if (song.playmode == PLAYMODE_PLAYING)
+    {
+        /* Already playing. */
+        return;
+    }
+
+    /* If music was paused, rewinding, or fastforwarding, then go
+    ** back to normal playback mode.  If it was never started, or
+    ** the song has been changed since, its timeline is gone, so
+    ** start it from where it stands. */
+    if (song.playmode == PLAYMODE_PAUSED ||
+        song.playmode == PLAYMODE_REWINDING ||
+        song.playmode == PLAYMODE_FASTFORWARDING)
+    {
+        if (song.rows != NULL)
+        {
+            song.playmode = PLAYMODE_PLAYING;
+            return;
+        }
+        from = song_counter;
+    }
+    else
+    {
+        /* If music is already playing, stop it. */
+        music_stop();
+        from = 0L;
+    }
+
+    /* Work out when each step plays, and how the channels
+    ** stand along the way. */
+    if (!music_timeline() || !music_keyframes())
+        return;
+
+    /* Set initial pan positions for each music channel. */
+    for (u = 0; u < music_channels; u++)
+    {
+        sss_channel_pan_set(music_first + u, song.pan_pos[u]);
+    }
+
+    /* Start the music. */
+    song_counter = from;
+    music_locate(from);
+    song.playmode = PLAYMODE_PLAYING;
+}
+
+/*
+** build_period_table:
+** Initializes the contents of the period_incr[] array, for
+** an Amiga clock rate and the mixing rate.  The Amiga plays
+** a period by stepping one sample each 'period' ticks of
+** its clock.  Does nothing if it's already built for them.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      clock   Clock rate in Hertz.
+**
+** Returns:
+**      NONE
+*/
+static void
+build_period_table(UINT clock)
+{
+    UINT    u;
+
+    if (clock == period_clock && mixrate == period_rate)
+        return;
+
+    period_incr[0] = 0;
+    for (u = 1; u <= SSS_MAX_PERIOD; u++)
+        period_incr[u] = ((ULONGLONG)clock << 32) / ((ULONGLONG)u * mixrate);
+    period_clock = clock;
+    period_rate = mixrate;
+}
+
+/*
+** build_cubic_table:
+** Initializes the contents of the cubic_table[] array.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      NONE
+*/
+static void
+build_cubic_table(void)
+{
+    int     u;
+    double  x;
+
+    for (u = 0; u < CUBIC_STEPS; u++)
+    {
+        x = (double)u / CUBIC_STEPS;
+        cubic_table[u][0] = (short)floor(0.5 + SSS_GAIN_UNITY *
+                        (-x * x * x + 2 * x * x - x) / 2);
+        cubic_table[u][2] = (short)floor(0.5 + SSS_GAIN_UNITY *
+                        (-3 * x * x * x + 4 * x * x + x) / 2);
+        cubic_table[u][3] = (short)floor(0.5 + SSS_GAIN_UNITY *
+                        (x * x * x - x * x) / 2);
+
+        /* Make the weights add up to exactly unity, so
+        ** a constant signal passes through unchanged. */
+        cubic_table[u][1] = (short)(SSS_GAIN_UNITY - cubic_table[u][0] -
+                        cubic_table[u][2] - cubic_table[u][3]);
+    }
+}
+
+/*
+** bessel_i0:
+** Computes the zeroth order modified Bessel function of the
+** first kind, for the Kaiser window.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      x       Value to evaluate function at.
+**
+** Returns:
+**      Value of function.
+*/
+static double
+bessel_i0(double x)
+{
+    double  sum = 1.0;
+    double  term = 1.0;
+    int     k;
+
+    for (k = 1; k < 32; k++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/*
+** build_sinc_table:
+** Initializes the contents of the sinc_table[] array for the
+** current number of taps.  Each row of taps is scaled to add
+** up to exactly unity, so a constant signal passes through
+** unchanged at every phase.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      NONE
+*/
+static void
+build_sinc_table(void)
+{
+    UINT    band;
+    UINT    phase;
+    UINT    k;
+    UINT    half;       /* Half the number of taps. */
+    UINT    peak;       /* Tap nearest the sample position. */
+    short   *row;       /* Row of taps being built. */
+    double  fc;         /* Cutoff of filter being built. */
+    double  frac;       /* Fractional sample position of row. */
+    double  d;          /* Distance from tap to sample position. */
+    double  x;
+    double  h[SSS_MAX_SINC_TAPS];
+    double  sum;
+    int     total;
+
+    half = sinc_taps / 2;
+    for (band = 0; band < SINC_BANDS; band++)
+    {
+        fc = SINC_CUTOFF / (double)(1 << band);
+        for (phase = 0; phase < SSS_SINC_PHASES; phase++)
+        {
+            /* Tap k is at sample point (whole position + 1 - half + k). */
+            frac = (double)phase / SSS_SINC_PHASES;
+            sum = 0.0;
+            for (k = 0; k < sinc_taps; k++)
+            {
+                d = (double)k + 1.0 - (double)half - frac;
+                x = d / (double)half;
+                h[k] = (x <= -1.0 || x >= 1.0) ? 0.0 :
+                        bessel_i0(SINC_BETA * sqrt(1.0 - x * x));
+                if (d != 0.0)
+                    h[k] *= sin(3.14159265358979 * fc * d) /
+                            (3.14159265358979 * d);
+                else
+                    h[k] *= fc;
+                sum += h[k];
+            }
+
+            /* Normalize, leaving rounding error on the peak tap. */
+            row = sinc_table + (band * SSS_SINC_PHASES + phase) * sinc_taps;
+            peak = half - 1 + (frac >= 0.5);
+            total = 0;
+            for (k = 0; k < sinc_taps; k++)
+            {
+                row[k] = (short)floor(0.5 + SSS_GAIN_UNITY * h[k] / sum);
+                total += row[k];
+            }
+            row[peak] = (short)(row[peak] + SSS_GAIN_UNITY - total);
+        }
+    }
+}
+
+/*
+** unroll_loop:
+** Replaces a sample that has a short loop with a copy in
+** which the loop is repeated enough times to be at least
+** UNROLLED_LOOP bytes long.  This plays back the same, but
+** lets the mixer render long runs between wraps.  If there
+** isn't enough memory the sample is left as it was.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      ps      Pointer to sample to unroll.
+**
+** Returns:
+**      NONE
+*/
+static void
+unroll_loop(SAMPLE_DESC *ps)
+{
+    UINT    reps;       /* Number of copies of loop. */
+    UINT    size;       /* Size of unrolled sample. */
+    UINT    v;
+    LPSTR   data;
+
+    reps = (UNROLLED_LOOP + ps->loop_size - 1) / ps->loop_size;
+    size = ps->loop_start + reps * ps->loop_size;
+    data = malloc(size);
+    if (data == NULL)
+        return;
+
+    /* Copy up to the end of the first pass through the loop,
+    ** then repeat the loop; anything after it is never played. */
+    memcpy(data, ps->data, ps->loop_start + ps->loop_size);
+    for (v = ps->loop_start + ps->loop_size; v < size; v++)
+        data[v] = data[v - ps->loop_size];
+
+    if (ps->owned)
+        free(ps->data);
+    ps->data = data;
+    ps->owned = TRUE;
+    ps->size = size;
+    ps->loop_size *= reps;
+}
+
+/*
+** free_sample:
+** Finds an unused entry in the samples list.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Index of unused entry, or SSS_MAX_SAMPLES if
+**      there are none.
+*/
+static UINT
+free_sample(void)
+{
+    UINT    u;
+
+    for (u = 0; u < SSS_MAX_SAMPLES; u++)
+    {
+        if (samples[u].data == NULL)
+            break;
+    }
+    return u;
+}
+
+/*
+** set_sample:
+** Fills in a sample descriptor for sss_sample_add() or
+** sss_sample_add_ref().
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      ps      Pointer to sample descriptor.
+**      data    Pointer to centered 8-bit PCM sample data.
+**      owned   TRUE if the library allocated 'data' and
+**              frees it when the sample is deleted.
+**      size    Size of data in bytes.
+**      loopbeg Offset where the loop starts.
+**      loopsiz Size of the loop, or zero if none.
+**      smprate Rate at which sample was recorded in Hertz.
+**
+** Returns:
+**      NONE
+*/
+static void
+set_sample(SAMPLE_DESC *ps, LPSTR data, BOOL owned,
+        UINT size, UINT loopbeg, UINT loopsiz, UINT smprate)
+{
+    ps->data = data;
+    ps->owned = owned;
+    ps->size = size;
+    ps->smprate = smprate;
+    ps->loop_start = loopbeg;
+    ps->loop_size = loopsiz;
+
+    /* Keep the loop inside the sample data, so the mixer
+    ** never has to check both ends. */
+    if (loopbeg >= size)
+    {
+        ps->loop_start = 0;
+        ps->loop_size = 0;
+    }
+    else if (loopsiz > size - loopbeg)
+    {
+        ps->loop_size = size - loopbeg;
+    }
+
+    /* Unroll short loops. */
+    if (ps->loop_size > 2 && ps->loop_size < SHORT_LOOP)
+        unroll_loop(ps);
+}
+
+/*
+** music_poll:
+** Called by mix() at the start of each segment.  Plays the
+** ticks and steps of the current music that are due by the
+** given song position, and works out how soon the next one
+** is due, so mix() can end the segment right there.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      songp   Current song position.
+**      rate    Song positions per frame mixed; more than
+**              one when fast forwarding.
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      NO_EVENT No song playing.
+**      other   Number of frames until the next tick or step.
+*/
+static UINT
+music_poll(DWORD songp, UINT rate)
+{
+    UINT            ichannel;
+    UINT            nchannels;  /* Channels in song used for music. */
+    DWORD           due;        /* When next tick or step plays. */
+    MUSICROW_DESC   *row;       /* Step being played. */
+
+    /* Is a song playing? */
+    if (song.rows == NULL ||
+            song.playmode == PLAYMODE_PAUSED ||
+            song.playmode == PLAYMODE_STOPPED)
+    {
+        /* No song playing, or song is paused. */
+        return NO_EVENT;
+    }
+
+    nchannels = song.nchannels;
+    if (nchannels > music_channels)
+        nchannels = music_channels;
+
+    while (1)
+    {
+        /* Play the next tick of this step if its time has come. */
+        if (song.itick < row_ticks(&song.rows[song.crow]) &&
+            song.tick_pos <= songp)
+        {
+            music_tick(&chan[music_first], song.tracks, nchannels,
+                    song.itick % song.rows[song.crow].ticks);
+            for (ichannel = 0; ichannel < nchannels; ichannel++)
+            {
+                if (chan[music_first + ichannel].isample != IDLE)
+                    list_channel(music_first + ichannel);
+            }
+            song.itick++;
+            song.tick_pos = music_tick_time(song.crow, song.itick) +
+                    song.row_lap;
+            continue;
+        }
+
+        /* Otherwise play the next step if its time has come. */
+        if (song.song_pos > songp)
+            break;
+
+        if (song.irow >= song.nrows)
+        {
+            /* Song is finished. */
+            song.playmode = PLAYMODE_STOPPED;
+            song.song_pos = 0L;
+            song_counter = 0L;
+            song.irow = 0;
+            song.laps = 0;
+            song.lap = 0;
+            song.istep = 0;
+            song.iorder = 0;
+            song.ipattern = 0;
+            return NO_EVENT;
+        }
+
+        /* Note where we are in the song. */
+        row = &song.rows[song.irow];
+        song.iorder = row->iorder;
+        song.ipattern = song.order[row->iorder];
+        song.istep = row->istep;
+        song.crow = song.irow;
+        song.row_lap = song.lap;
+        song.itick = 1;
+        song.tick_pos = music_tick_time(song.crow, 1) + song.row_lap;
+
+        /* Process notes in this step of the pattern, for as
+        ** many of the song's channels as we have for music,
+        ** and make sure the mixer knows about any started. */
+        music_row(&chan[music_first], song.tracks, nchannels, row);
+        for (ichannel = 0; ichannel < nchannels; ichannel++)
+        {
+            if (chan[music_first + ichannel].isample != IDLE)
+                list_channel(music_first + ichannel);
+        }
+
+        music_next();
+    }
+
+    /* Frames until the next tick or step, rounded up. */
+    due = song.song_pos;
+    if (song.itick < row_ticks(&song.rows[song.crow]) && song.tick_pos < due)
+        due = song.tick_pos;
+    return (due - songp + rate - 1) / rate;
+}
+
+/*
+** sample_at:
+** Fetches one point of sample data for interpolation, where
+** the point may lie past the end of the sample or loop.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      data    Sample data.
+**      idx     Offset of point to fetch.
+**      loop_end Offset where sample ends or loops.
+**      loop_size Length of loop (looping samples only).
+**      looping Nonzero if the sample loops.
+**
+** Returns:
+**      Signed sample value; past the end of a non-looping
+**      sample this is silence.
+*/
+static __forceinline int
+sample_at(const signed char *data, UINT idx, UINT loop_end,
+        UINT loop_size, const UINT looping)
+{
+    if (idx < loop_end)
+        return data[idx];
+    if (!looping)
+        return 0;
+    return data[idx - loop_size];
+}
+
+/*
+** run_length:
+** Works out how many frames a voice can be stepped before its
+** position reaches a given point in the sample data.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      pos     Current position, which must be before 'end'.
+**      incr    Step between frames.
+**      end     Offset in sample data that ends the run.
+**      frames  Maximum number of frames wanted.
+**
+** Returns:
+**      Number of frames in run, from 1 to 'frames'.
+*/
+static __forceinline UINT
+run_length(ULONGLONG pos, ULONGLONG incr, UINT end, UINT frames)
+{
+    ULONGLONG   n;
+
+    if (incr == 0)
+        return frames;
+    n = ((((ULONGLONG)end << 32) - pos) - 1) / incr + 1;
+    return (n < frames) ? (UINT)n : frames;
+}
+
+/*
+** interpolate:
+** Fetches the value of a sample at a fractional position.
+** Like render_voice(), this is always expanded inline with
+** constant 'looping', 'interp' and 'edge'.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      data    Sample data.
+**      pos     Position to fetch, before 'loop_end'.
+**      loop_end Offset where sample ends or loops.
+**      loop_size Length of loop (looping samples only).
+**      looping Nonzero if the sample loops.
+**      interp  SSS_INTERP_NEAREST, SSS_INTERP_LINEAR or
+**              SSS_INTERP_CUBIC.
+**      edge    Zero if the caller knows all the points used
+**              lie inside the data (at least one point before
+**              'pos' and two before 'loop_end'), so they can
+**              be read without checks.
+**
+** Returns:
+**      Sample value, scaled to 16 bits.
+*/
+static __forceinline int
+interpolate(const signed char *data, ULONGLONG pos, UINT loop_end,
+        UINT loop_size, const UINT looping, const UINT interp,
+        const UINT edge)
+{
+    UINT        offset;     /* Offset into sample data. */
+    const short *w;         /* Cubic weights for this position. */
+    int         p0, p1, p2, p3; /* Sample points around position. */
+    int         ival;
+
+    offset = (UINT)(pos >> 32);
+    if (interp == SSS_INTERP_LINEAR)
+    {
+        /* Weight the next point by the 16-bit fraction. */
+        p1 = data[offset];
+        if (edge)
+            p2 = sample_at(data, offset + 1, loop_end, loop_size, looping);
+        else
+            p2 = data[offset + 1];
+        return p1 * 256 +
+                (((p2 - p1) * (int)(((DWORD)pos >> 16) & 0xFFFF)) >> 8);
+    }
+
+    if (interp == SSS_INTERP_CUBIC)
+    {
+        /* Fit a spline through the points either side. */
+        if (edge)
+        {
+            p0 = (offset > 0) ? data[offset - 1] : data[offset];
+            p2 = sample_at(data, offset + 1, loop_end, loop_size, looping);
+            p3 = sample_at(data, offset + 2, loop_end, loop_size, looping);
+        }
+        else
+        {
+            p0 = data[offset - 1];
+            p2 = data[offset + 1];
+            p3 = data[offset + 2];
+        }
+        p1 = data[offset];
+        w = cubic_table[((DWORD)pos >> 24) & (CUBIC_STEPS - 1)];
+        ival = (w[0] * p0 + w[1] * p1 + w[2] * p2 + w[3] * p3) >> 6;
+        if (ival > 32767)
+            ival = 32767;
+        else if (ival < -32768)
+            ival = -32768;
+        return ival;
+    }
+
+    return data[offset] * 256;
+}
+
+/*
+** sinc_run:
+** Resamples a run of frames of a sample with a windowed sinc
+** filter.  Where the filter's window lies wholly inside the
+** sample data, as many frames as stay inside are filtered
+** straight from it; otherwise one frame is filtered from a
+** copy of the window with the edges filled in.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      dst     Where to store resampled frames.
+**      data    Sample data.
+**      pos     Position of first frame, which must be
+**              before 'loop_end'.
+**      incr    Step between frames.
+**      frames  Maximum number of frames to resample.
+**      loop_end Offset where sample ends or loops.
+**      loop_size Length of loop (looping samples only).
+**      looping Nonzero if the sample loops.
+**      table   Filter to use, from sinc_table[].
+**
+** Returns:
+**      Number of frames resampled, at least one.
+*/
+static UINT
+sinc_run(short *dst, const signed char *data, ULONGLONG pos,
+        ULONGLONG incr, UINT frames, UINT loop_end, UINT loop_size,
+        UINT looping, const short *table)
+{
+    UINT        offset;     /* Whole part of position. */
+    UINT        half;       /* Half the number of taps. */
+    UINT        first;      /* First point in window. */
+    UINT        k;
+    UINT        n;
+    int         idx;
+    signed char win[SSS_MAX_SINC_TAPS];
+
+    offset = (UINT)(pos >> 32);
+    half = sinc_taps / 2;
+
+    if (offset + 1 >= half && offset + half < loop_end)
+    {
+        /* Window is inside the data until the position
+        ** reaches (loop_end - half). */
+        first = offset + 1 - half;
+        n = run_length(pos, incr, loop_end - half, frames);
+        kernels->resample_sinc(dst, data + first,
+                pos - ((ULONGLONG)offset << 32), incr, n, table, sinc_taps);
+        return n;
+    }
+
+    /* Near an edge; silence before the start, and past the end
+    ** either silence or the start of the loop. */
+    for (k = 0; k < sinc_taps; k++)
+    {
+        idx = (int)offset + 1 - (int)half + (int)k;
+        if (idx < 0)
+            win[k] = 0;
+        else if ((UINT)idx < loop_end)
+            win[k] = data[idx];
+        else if (!looping)
+            win[k] = 0;
+        else
+            win[k] = data[loop_end - loop_size +
+                        ((UINT)idx - loop_end) % loop_size];
+    }
+    kernels->resample_sinc(dst, win, pos & 0xFFFFFFFF, incr, 1,
+            table, sinc_taps);
+    return 1;
+}
+
+/*
+** render_voice:
+** Mixes the sample playing on one channel into the
+** accumulation buffer for a run of frames.  Stops the
+** channel if a non-looping sample ends during the run.
+**
+** This is never called directly.  It is expanded inline with
+** constant values for 'stereo', 'looping' and 'interp' by each
+** of the render_...() functions below, so the tests on them
+** are resolved by the compiler and drop out of the loops.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      pc      Pointer to channel to be mixed.
+**      bus     Pointer to first frame in mixbus to mix into.
+**      frames  Number of frames to mix.
+**      scratch Buffer of at least 'frames' shorts for the
+**              resampled voice.
+**      stereo  Nonzero to mix into a stereo bus.
+**      looping Nonzero if the sample loops.
+**      interp  Interpolation mode (SSS_INTERP_...).
+**
+** Returns:
+**      NONE
+*/
+static __forceinline void
+render_voice(CHANNEL_DESC *pc, int *bus, UINT frames, short *scratch,
+        const UINT stereo, const UINT looping, const UINT interp)
+{
+    UINT        u;          /* Loop index. */
+    UINT        n;          /* Frames done in one pass. */
+    UINT        k;          /* Loop index within a pass. */
+    UINT        offset;     /* Offset into sample data. */
+    UINT        loop_end;   /* Offset where sample ends or loops. */
+    UINT        loop_size;  /* Length of loop. */
+    ULONGLONG   loop_len;   /* Length of loop, as 32.32 fixed point. */
+    ULONGLONG   pos;        /* Local copy of channel position. */
+    ULONGLONG   incr;       /* Local copy of channel increment. */
+    SAMPLE_DESC *psample;   /* Pointer to sample on this channel. */
+    const signed char *data; /* Sample data. */
+    const short *table;     /* Sinc filter for this pitch. */
+    UINT        band;       /* Band of sinc filter. */
+    UINT        fast_end;   /* Offset where unchecked reads stop. */
+
+    psample = &samples[pc->isample];
+    data = (const signed char *)psample->data;
+    if (looping)
+        loop_end = psample->loop_start + psample->loop_size;
+    else
+        loop_end = psample->size;
+    loop_size = psample->loop_size;
+    loop_len = (ULONGLONG)loop_size << 32;
+    pos = pc->pos;
+    incr = pc->incr;
+
+    /* Interpolation reads up to two points ahead, so it
+    ** has to stop short of the end to read without checks. */
+    fast_end = loop_end;
+    if (interp == SSS_INTERP_LINEAR)
+        fast_end = loop_end - 1;
+    else if (interp == SSS_INTERP_CUBIC)
+        fast_end = (loop_end > 2) ? loop_end - 2 : 0;
+
+    /* Pick the sinc filter with a cutoff low enough for this
+    ** pitch that it doesn't alias. */
+    table = NULL;
+    if (interp == SSS_INTERP_SINC)
+    {
+        for (band = 0; band < SINC_BANDS - 1 &&
+            incr > ((ULONGLONG)1 << (32 + band)); band++)
+            ;
+        table = sinc_table + band * SSS_SINC_PHASES * sinc_taps;
+    }
+
+    /*
+    ** Resample this run of the sample into scratch.  Each
+    ** pass handles the end of the sample or loop, then
+    ** renders as many frames as it can before reaching it
+    ** again with no more checks.
+    */
+    for (u = 0; u < frames; u += n)
+    {
+        /* Whole part of the position is the offset into sample data. */
+        offset = (UINT)(pos >> 32);
+
+        /* End of this sample yet? */
+        if (offset >= loop_end)
+        {
+            if (looping)
+            {
+                /* End of looping sample; repeat it, keeping
+                ** the fractional overshoot. */
+                do
+                {
+                    pos -= loop_len;
+                    offset = (UINT)(pos >> 32);
+                } while (offset >= loop_end);
+            }
+            else
+            {
+                /* End of sample; stop playing it. */
+                pc->isample = IDLE;
+                pos = 0;
+                incr = 0;
+                break;
+            }
+        }
+
+        if (interp == SSS_INTERP_SINC)
+        {
+            /* Filter as many frames as we can in one go. */
+            n = sinc_run(&scratch[u], data, pos, incr, frames - u,
+                    loop_end, loop_size, looping, table);
+            pos += incr * n;
+        }
+        else if (offset < fast_end &&
+                (interp != SSS_INTERP_CUBIC || offset > 0))
+        {
+            /* Run up to the end with no checks. */
+            n = run_length(pos, incr, fast_end, frames - u);
+            for (k = 0; k < n; k++)
+            {
+                scratch[u + k] = (short)interpolate(data, pos,
+                        loop_end, loop_size, looping, interp, 0);
+                pos += incr;
+            }
+        }
+        else
+        {
+            /* Near an edge; do one frame the careful way. */
+            n = 1;
+            scratch[u] = (short)interpolate(data, pos,
+                    loop_end, loop_size, looping, interp, 1);
+            pos += incr;
+        }
+    }
+
+    pc->pos = pos;
+    pc->incr = incr;
+
+    /* Scale it by the channel's volume and pan into the mix. */
+    if (stereo)
+        kernels->accum_stereo(bus, scratch, u, pc->gain_l, pc->gain_r);
+    else
+        kernels->accum_mono(bus, scratch, u, pc->gain);
+}
+
+/*
+** Specialized versions of render_voice().  Named for
+** output channels, looping and interpolation mode.
+*/
+
+static void
+render_mono_once_nearest(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 0, 0, SSS_INTERP_NEAREST);
+}
+
+static void
+render_mono_once_linear(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 0, 0, SSS_INTERP_LINEAR);
+}
+
+static void
+render_mono_once_cubic(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 0, 0, SSS_INTERP_CUBIC);
+}
+
+static void
+render_mono_once_sinc(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 0, 0, SSS_INTERP_SINC);
+}
+
+static void
+render_mono_loop_nearest(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 0, 1, SSS_INTERP_NEAREST);
+}
+
+static void
+render_mono_loop_linear(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 0, 1, SSS_INTERP_LINEAR);
+}
+
+static void
+render_mono_loop_cubic(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 0, 1, SSS_INTERP_CUBIC);
+}
+
+static void
+render_mono_loop_sinc(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 0, 1, SSS_INTERP_SINC);
+}
+
+static void
+render_stereo_once_nearest(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 1, 0, SSS_INTERP_NEAREST);
+}
+
+static void
+render_stereo_once_linear(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 1, 0, SSS_INTERP_LINEAR);
+}
 
-                case SSS_EFFECT_SET_TEMPO:
-                    if (step->note_eparam[ichannel] != 0)
-                        song.step_delay = ((long)mixrate * (1 + (long)step->note_eparam[ichannel])) / 65L;
-                    break;
+static void
+render_stereo_once_cubic(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 1, 0, SSS_INTERP_CUBIC);
+}
 
-                case SSS_EFFECT_SET_VOLUME:
-                    sss_channel_volume(SSS_MUSIC_FIRST + ichannel,
-                            step->note_eparam[ichannel] * music_volume / 63);
-                    break;
+static void
+render_stereo_once_sinc(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 1, 0, SSS_INTERP_SINC);
+}
 
-                case SSS_EFFECT_NONE:
-                default:
-                        ; /* Do nothing. */
-            }
-        }
+static void
+render_stereo_loop_nearest(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 1, 1, SSS_INTERP_NEAREST);
+}
+
+static void
+render_stereo_loop_linear(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 1, 1, SSS_INTERP_LINEAR);
+}
+
+static void
+render_stereo_loop_cubic(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 1, 1, SSS_INTERP_CUBIC);
+}
+
+static void
+render_stereo_loop_sinc(CHANNEL_DESC *pc, int *bus, UINT frames,
+        short *scratch)
+{
+    render_voice(pc, bus, frames, scratch, 1, 1, SSS_INTERP_SINC);
+}
+
+/*
+** Table of specialized voice renderers, indexed by
+** [stereo][looping][interpolation mode].
+*/
+static const VOICE_RENDER voice_renderers[2][2][NUM_INTERP] =
+{
+    {
+        { render_mono_once_nearest,
+          render_mono_once_linear,
+          render_mono_once_cubic,
+          render_mono_once_sinc },
+        { render_mono_loop_nearest,
+          render_mono_loop_linear,
+          render_mono_loop_cubic,
+          render_mono_loop_sinc }
+    },
+    {
+        { render_stereo_once_nearest,
+          render_stereo_once_linear,
+          render_stereo_once_cubic,
+          render_stereo_once_sinc },
+        { render_stereo_loop_nearest,
+          render_stereo_loop_linear,
+          render_stereo_loop_cubic,
+          render_stereo_loop_sinc }
+    }
+};
+
+/*
+** mix_channel:
+** Mixes the sample playing on one channel into the
+** accumulation buffer for a run of frames, using the
+** renderer specialized for the channel's current setup.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      pc      Pointer to channel to be mixed.
+**      bus     Pointer to first frame in mixbus to mix into.
+**      frames  Number of frames to mix.
+**      scratch Buffer of at least 'frames' shorts for the
+**              resampled voice.
+**
+** Returns:
+**      NONE
+*/
+static void
+mix_channel(CHANNEL_DESC *pc, int *bus, UINT frames, short *scratch)
+{
+    UINT    looping;
+    UINT    mode;
+
+    /* Silent channels only need to keep their place. */
+    if (pc->gain == 0)
+    {
+        skip_voice(pc, frames);
+        return;
+    }
+
+    looping = (samples[pc->isample].loop_size > 2);
+    mode = pc->interp;
+    if (mode >= NUM_INTERP)
+        mode = interp_mode;
+    voice_renderers[is_stereo][looping][mode](pc, bus, frames, scratch);
+}
+
+/*
+** mix_share:
+** Mixes one thread's share of the channels in active[] into an
+** accumulation buffer, for the segment described by job_voices,
+** job_offset and job_frames.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      first   Index of first entry of active[] to mix.
+**      stride  Mix every stride'th entry from there on.
+**      bus     Accumulation buffer to mix into.
+**      scratch Buffer of at least job_frames shorts for
+**              resampling.
+**
+** Returns:
+**      NONE
+*/
+static void
+mix_share(UINT first, UINT stride, int *bus, short *scratch)
+{
+    UINT    v;              /* Index into active channel list. */
+    CHANNEL_DESC *pc;       /* Channel being mixed. */
+
+    for (v = first; v < job_voices; v += stride)
+    {
+        pc = &chan[active[v]];
+        if (pc->isample != IDLE)
+            mix_channel(pc, &bus[job_offset], job_frames, scratch);
+    }
+}
+
+/*
+** mix_worker:
+** Thread function for the threads in workers[].  Waits to be
+** started by mix(), mixes its share of the channels, then
+** signals that it's done, until told to quit.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      param   Pointer to the thread's MIX_WORKER.
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      0       Thread exited.
+*/
+static DWORD WINAPI
+mix_worker(LPVOID param)
+{
+    MIX_WORKER *pw = (MIX_WORKER *)param;
+
+    for (;;)
+    {
+        WaitForSingleObject(pw->start, INFINITE);
+        if (workers_quit)
+            break;
+
+        /* First share of this buffer?  Start with silence. */
+        if (job_clear)
+            memset(pw->bus, 0, sizeof(int) * bfr_frames * (is_stereo + 1));
+
+        mix_share(pw->index, num_workers, pw->bus, pw->voicebuf);
+        SetEvent(pw->done);
+    }
+
+    return 0;
+}
+
+/*
+** free_worker:
+** Discards the handles and buffers of a worker thread.  The
+** thread must have exited, or never been started.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      pw      Pointer to the worker.
+**
+** Returns:
+**      NONE
+*/
+static void
+free_worker(MIX_WORKER *pw)
+{
+    if (pw->thread != NULL)
+        CloseHandle(pw->thread);
+    if (pw->start != NULL)
+        CloseHandle(pw->start);
+    if (pw->done != NULL)
+        CloseHandle(pw->done);
+    free(pw->bus);
+    free(pw->voicebuf);
+    memset(pw, 0, sizeof(MIX_WORKER));
+}
 
-        /* Update current position in song. */
-        song.song_pos += song.step_delay;
+/*
+** start_workers:
+** Starts the pool of threads that help mix, one per CPU or as
+** set by sss_set_mix_threads().  If some of them can't be
+** started, mixing makes do with the ones that could.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      NONE
+*/
+static void
+start_workers(void)
+{
+    SYSTEM_INFO sysinfo;
+    MIX_WORKER *pw;
+    UINT        count;      /* Number of threads wanted. */
+    UINT        u;
 
-        /* Step to next step. */
-        song.istep++;
+    count = mix_threads;
+    if (count == 0)
+    {
+        GetSystemInfo(&sysinfo);
+        count = sysinfo.dwNumberOfProcessors;
+    }
+    if (count > SSS_MAX_MIX_THREADS)
+        count = SSS_MAX_MIX_THREADS;
 
-        /* Step to next pattern if ready. */
-        if (song.istep >= song.patterns[song.ipattern].nsteps)
+    workers_quit = 0;
+    num_workers = 1;
+    for (u = 1; u < count; u++)
+    {
+        pw = &workers[u];
+        memset(pw, 0, sizeof(MIX_WORKER));
+        pw->index = u;
+        pw->bus = malloc(sizeof(int) * bfr_frames * (is_stereo + 1));
+        pw->voicebuf = malloc(sizeof(short) * bfr_frames);
+        pw->start = CreateEvent(NULL, FALSE, FALSE, NULL);
+        pw->done = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (pw->bus != NULL && pw->voicebuf != NULL &&
+            pw->start != NULL && pw->done != NULL)
         {
-            song.iorder++;
-            song.istep = 0;
+            pw->thread = CreateThread(NULL, 0, mix_worker, pw, 0, NULL);
         }
-
-        /* See if song is done yet. */
-        if (song.iorder >= song.norder)
+        if (pw->thread == NULL)
         {
-            /* Song is finished. */
-            song.playmode = PLAYMODE_STOPPED;
-            song.song_pos = 0L;
-            song_counter = 0L;
-            song.istep = 0;
-            song.iorder = 0;
-            song.ipattern = 0;
+            /* Couldn't start it; do without. */
+            free_worker(pw);
+            break;
         }
+
+        /* Mixing is as time critical as the thread it helps. */
+        SetThreadPriority(pw->thread, THREAD_PRIORITY_HIGHEST);
+        worker_done[num_workers - 1] = pw->done;
+        num_workers++;
+    }
+}
+
+/*
+** stop_workers:
+** Stops the pool of threads started by start_workers().
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      NONE
+*/
+static void
+stop_workers(void)
+{
+    UINT    u;
+
+    workers_quit = 1;
+    for (u = 1; u < num_workers; u++)
+    {
+        SetEvent(workers[u].start);
+        WaitForSingleObject(workers[u].thread, INFINITE);
+        free_worker(&workers[u]);
     }
+    num_workers = 1;
+    workers_quit = 0;
+}
+
+/*
+** free_mix_buffers:
+** Stops the threads that help mix, and discards the channels
+** and the buffers used for mixing.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      NONE
+*/
+static void
+free_mix_buffers(void)
+{
+    stop_workers();
+    free(mixbus);
+    mixbus = NULL;
+    free(voicebuf);
+    voicebuf = NULL;
+    free(sinc_table);
+    sinc_table = NULL;
+    free(chan);
+    chan = NULL;
+    free(active);
+    active = NULL;
+    num_active = 0;
 }
 
 /*
@@ -457,6 +3341,12 @@ music_poll(DWORD songp)
 ** state of various variable in this module to reflect the
 ** time advancement of the mix.
 **
+** Each playing channel is mixed into mixbus for a whole
+** segment at a time, then the finished mix is scaled,
+** clipped and stored into the output buffer in one pass.
+** Segments end where the music has its next step due, so
+** the music system is only called between segments.
+**
 ** Parameters:
 **      NONE
 **
@@ -467,136 +3357,290 @@ static void
 mix(void)
 {
     UINT    u;              /* Loop index. */
-    UINT    step;           /* Number of bytes per sample in this buffer. */
-    UINT    ch;             /* Channel loop index. */
-    UINT    offset;         /* Offset into sample data. */
-    int     mixval_l;       /* Intermediate value for mixing, left. */
-    int     mixval_r;       /* Intermediate value for mixing, right. */
-    SAMPLE_DESC *psample;   /* Pointer to current sample. */
-    int     ival;           /* Temporary signed integer for mixing. */
-
-    /* Determine how to step through the audio buffer. */
+    UINT    step;           /* Number of bus values per frame. */
+    UINT    v;              /* Index into active channel list. */
+    UINT    k;              /* Index into mix bus. */
+    CHANNEL_DESC *pc;       /* Channel being mixed. */
+    UINT    frames;         /* Number of frames in the audio buffer. */
+    UINT    mode;           /* Music play mode as mixing began. */
+    UINT    rate;           /* Song positions per frame. */
+    UINT    due;            /* Frames until next music step. */
+    UINT    n;              /* Frames in current segment. */
+    UINT    shared;         /* Nonzero once workers have mixed. */
+    int     *bus;           /* A worker's accumulation buffer. */
+
+    /* Determine how to step through the mix bus. */
     step = 1;
     if (is_stereo)
     {
         step *= 2;
     }
+    frames = bfr_frames;
+    mode = song.playmode;
+    rate = (mode == PLAYMODE_FASTFORWARDING) ? 4 : 1;
 
-    /* Step through each sample in the audio buffer. */
-    for (u = 0; u < bfr_size; u += step)
+    /* Start with silence. */
+    memset(mixbus, 0, sizeof(int) * frames * step);
+    shared = 0;
+
+    /* Mix the buffer one segment at a time. */
+    for (u = 0; u < frames; u += n)
     {
-        /* Poll for music a few times per buffer. */
-        if (u == 0 || (u >> 1) % ((mixrate / 64) >> is_stereo) == 0)
+        /* Let the music system start any new notes, and
+        ** end the segment where it has more to start. */
+        due = music_poll(song_counter + u * rate, rate);
+
+        n = frames - u;
+        if (n > SEGMENT_FRAMES)
+            n = SEGMENT_FRAMES;
+        if (n > due)
+            n = due;
+
+        /* Mix each channel that is playing something.  If there
+        ** are enough of them, share them out among the workers. */
+        job_voices = num_active;
+        job_offset = u * step;
+        job_frames = n;
+        if (num_workers > 1 && job_voices >= mix_threshold)
         {
-            music_poll(song_counter + (u / step));
+            job_clear = !shared;
+            for (v = 1; v < num_workers; v++)
+                SetEvent(workers[v].start);
+            mix_share(0, num_workers, mixbus, voicebuf);
+            WaitForMultipleObjects(num_workers - 1, worker_done, TRUE,
+                    INFINITE);
+            shared = 1;
         }
-
-        /* Assume nil volume. */
-        mixval_l = 0;
-        mixval_r = 0;
-
-        /* Handle each channel. */
-        for (ch = 0; ch < SSS_MAX_CHANNELS; ch++)
+        else
         {
-            /* Is this channel playing something? */
-            if (chan[ch].isample == IDLE)
-            {
-                /* This channel is not playing. */
-                continue;
-            }
-
-            /* Get a pointer to the sample on this channel. */
-            psample = &samples[chan[ch].isample];
-
-            /* Calculate actual offset into sample data. */
-            offset = (UINT)((chan[ch].voffset *
-                            (long)psample->size) /
-                            chan[ch].vsize);
-
-            /* End of this sample yet? */
-            if (offset >= psample->size ||
-                (offset >= (psample->loop_start +
-                    psample->loop_size) &&
-                    (psample->loop_size > 0)))
-            {
-                /* Looping sample or not? */
-                if (psample->loop_size > 2)
-                {
-                    /* End of looping sample; repeat it. */
-                    chan[ch].voffset = psample->loop_start;
-                    continue;
-                }
-                else
-                {
-                    /* End of sample; stop playing it. */
-                    chan[ch].isample = IDLE;
-                    chan[ch].voffset = 0;
-                    chan[ch].vsize = 0;
-                    continue;
-                }
-            }
+            mix_share(0, 1, mixbus, voicebuf);
+        }
 
-            /* Merge byte of sample data into mix. */
-            ival = (int)psample->data[offset] + 128;
-            ival = chan[ch].volume[ival];
-            if (is_stereo)
+        /* Drop channels that have finished from the list. */
+        EnterCriticalSection(&active_lock);
+        for (v = 0; v < num_active; )
+        {
+            pc = &chan[active[v]];
+            if (pc->isample == IDLE)
             {
-                mixval_l += volume_tables[SSS_MAX_VOLUME - 1 - chan[ch].pan_pos][ival + 128];
-                mixval_r += volume_tables[chan[ch].pan_pos][ival + 128];
+                pc->listed = 0;
+                active[v] = active[--num_active];
             }
             else
             {
-                mixval_l += ival;
+                v++;
             }
-
-            /* Step to next relative offset. */
-            chan[ch].voffset++;
         }
+        LeaveCriticalSection(&active_lock);
+    }
 
-        /* Scale mixed value back down and uncenter. */
-        mixval_l >>= 2;
-        mixval_l += 127;
-        mixval_r >>= 2;
-        mixval_r += 127;
-
-        /* Put mixed value into buffer. */
-        buffers[bfr_toggle][u] = (unsigned char)mixval_l;
-        if (is_stereo)
+    /* Add in what the workers mixed, always in the same order. */
+    if (shared)
+    {
+        for (v = 1; v < num_workers; v++)
         {
-            buffers[bfr_toggle][u + 1] = (unsigned char)mixval_r;
+            bus = workers[v].bus;
+            for (k = 0; k < frames * step; k++)
+                mixbus[k] += bus[k];
         }
     }
 
-    /* Update song time counter. */
-    if (song.playmode == PLAYMODE_PLAYING)
+    /* Scale mixed values to the output format and clip. */
+    switch (out_format)
+    {
+        case OUTFMT_F32:
+            kernels->pack_f32((float *)buffers[bfr_toggle], mixbus,
+                    frames * step);
+            break;
+
+        case OUTFMT_S16:
+            kernels->pack_s16((short *)buffers[bfr_toggle], mixbus,
+                    frames * step);
+            break;
+
+        case OUTFMT_U8:
+        default:
+            kernels->pack_u8((unsigned char *)buffers[bfr_toggle], mixbus,
+                    frames * step);
+    }
+
+    /* Update song time counter, by as much as the music was
+    ** moved on while mixing, unless it has stopped since. */
+    if (song.playmode == PLAYMODE_STOPPED)
+    {
+        /* Nothing to time. */
+    }
+    else if (mode == PLAYMODE_PLAYING)
     {
         /* Normal play mode. */
-        song_counter += (DWORD)bfr_size / step;
+        song_counter += (DWORD)frames;
     }
-    else if (song.playmode == PLAYMODE_FASTFORWARDING)
+    else if (mode == PLAYMODE_FASTFORWARDING)
     {
         /* FFWD:  Play 4x normal speed */
-        song_counter += (DWORD)bfr_size * 4 / step;
+        song_counter += (DWORD)frames * 4;
     }
-    else if (song.playmode == PLAYMODE_REWINDING)
+    else if (mode == PLAYMODE_REWINDING)
+    {
+        /* REWIND:  Back up 4x normal speed */
+        if (song_counter > (DWORD)frames * 4)
+        {
+            /* Each buffer plays forward from where the last one
+            ** started, less four buffers' worth, so we can hear
+            ** as we are rewinding. */
+            song_counter -= (DWORD)frames * 4;
+            music_locate(song_counter);
+        }
+        else
+        {
+            /* Rewound to beginning of song. */
+            music_stop();
+        }
+    }
+}
+
+/*
+** load_cancel:
+** Tells a load started by sss_music_load_async() to give
+** up.  If its song is waiting to be swapped in, it's taken
+** back, and the loading thread discards it.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      job     Pointer to load.
+**
+** Returns:
+**      NONE
+*/
+static void
+load_cancel(LOAD_JOB *job)
+{
+    InterlockedExchange(&job->cancel, 1);
+    if (InterlockedCompareExchangePointer((PVOID volatile *)&pending,
+            NULL, job) == job)
+        SetEvent(job->swapped);
+}
+
+/*
+** load_wait:
+** Cancels the last load started by sss_music_load_async(),
+** if it's still going, waits for its thread to finish, and
+** discards it.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      NONE
+*/
+static void
+load_wait(void)
+{
+    if (load_job == NULL)
+        return;
+
+    load_cancel(load_job);
+    WaitForSingleObject(load_job->thread, INFINITE);
+    CloseHandle(load_job->thread);
+    CloseHandle(load_job->swapped);
+    free(load_job);
+    load_job = NULL;
+}
+
+/*
+** load_worker:
+** Thread function for sss_music_load_async().  Loads the
+** song into the LOAD_JOB, apart from the current song, and
+** hands it to sss_poll() to swap in.  Then discards what it
+** gets back:  the song that was replaced, or the new one if
+** the load was cancelled; either way that work stays off
+** the thread that mixes.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      param   Pointer to the LOAD_JOB.
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      0       Thread exited.
+*/
+static DWORD WINAPI
+load_worker(LPVOID param)
+{
+    LOAD_JOB    *job = (LOAD_JOB *)param;
+    UINT        result;
+
+    /* Build the song on the side. */
+    def_job = job;
+    result = SSSERR_CANCELLED;
+    if (!job->cancel)
+        result = sss_music_load_mod(job->fn);
+
+    /* Wait for it to be swapped in, at the next buffer.  If the
+    ** load was cancelled while the song was being handed over,
+    ** take it back, unless load_cancel() already has. */
+    if (result == SSSERR_OK)
+    {
+        InterlockedExchangePointer((PVOID volatile *)&pending, job);
+        if (job->cancel && InterlockedCompareExchangePointer(
+                (PVOID volatile *)&pending, NULL, job) == job)
+        {
+            /* Nothing will swap it in. */
+            result = SSSERR_CANCELLED;
+        }
+        else
+        {
+            WaitForSingleObject(job->swapped, INFINITE);
+            if (!job->taken)
+                result = SSSERR_CANCELLED;
+        }
+    }
+
+    /* Discard whichever song was left here. */
+    sss_music_flush();
+    def_job = NULL;
+
+    if (job->done != NULL)
+        job->done(result, job->param);
+    return 0;
+}
+
+/*
+** music_swap:
+** Makes a song loaded by sss_music_load_async() the current
+** song, and hands the song it replaces back to the loading
+** thread to discard.  Called by sss_poll() between buffers,
+** with 'music_lock' held, so no buffer is mixed from parts
+** of both songs, and nothing else is working on the current
+** song.  The new song starts out stopped.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      job     Pointer to load.
+**
+** Returns:
+**      NONE
+*/
+static void
+music_swap(LOAD_JOB *job)
+{
+    MUSICSONG_DESC  old;    /* Song being replaced. */
+
+    if (!job->cancel)
     {
-        /* REWIND:  Back up 4x normal speed */
-        if (song_counter > (DWORD)bfr_size * 4 / step)
-        {
-            /* Also back up the song_counter, so we
-            ** can hear as we are rewinding. */
-            song_counter -= (DWORD)bfr_size * 4 / step;
-            if (song_counter > bfr_size)
-                song.song_pos = song_counter - bfr_size;
-            else
-                song.song_pos = 0;
-        }
-        else
-        {
-            /* Rewound to beginning of song. */
-            music_stop();
-        }
+        /* Silence the old song; its samples are about to go. */
+        music_stop();
+        old = song;
+        song = job->song;
+        job->song = old;
+        build_period_table(song.clock);
+        job->taken = TRUE;
     }
+    SetEvent(job->swapped);
 }
 
 /*
@@ -615,6 +3659,8 @@ static void
 sss_poll(void)
 {
     static UINT busy = 0;   /* Busy flag, to prevent recursive entry. */
+    LARGE_INTEGER   t0, t1; /* When mixing started and ended. */
+    LOAD_JOB        *job;   /* Load with a song to swap in. */
 
     prof_count_polls++;
 
@@ -646,8 +3692,19 @@ sss_poll(void)
     /* Turn off the 'done' flag. */
     wavehdrs[bfr_toggle].dwFlags &= ~WHDR_DONE;
 
-    /* Mix the next bufferfull of audio data. */
+    /* Swap in a newly loaded song, if one is ready, then mix
+    ** the next bufferfull of audio data, timing it. */
+    EnterCriticalSection(&music_lock);
+    job = (LOAD_JOB *)InterlockedExchangePointer(
+            (PVOID volatile *)&pending, NULL);
+    if (job != NULL)
+        music_swap(job);
+    QueryPerformanceCounter(&t0);
     mix();
+    QueryPerformanceCounter(&t1);
+    LeaveCriticalSection(&music_lock);
+    load_ticks += t1.QuadPart - t0.QuadPart;
+    load_frames += bfr_frames;
 
 #if 0
     /* Unprepare the next header. */
@@ -760,21 +3817,14 @@ sss_init(HINSTANCE hinst)
         samples[u].smprate = 0;
     }
 
-    /* Reset all channels. */
-    for (u = 0; u < SSS_MAX_CHANNELS; u++)
-    {
-        chan[u].pan_pos = SSS_PAN_CENTER;
-        chan[u].isample = IDLE;
-        chan[u].voffset = 0;
-        chan[u].vsize = 0;
-        chan[u].volume = &volume_tables[SSS_MAX_VOLUME - 1][0];
-    }
-
     /* Mark song data as unused. */
     memset(&song, 0, sizeof(song));
 
-    /* Build volume tables. */
-    build_volume_tables();
+    /* Pick the mixing kernels for this CPU. */
+    kernels = sss_mix_select();
+
+    /* Build interpolation tables. */
+    build_cubic_table();
 
     /* Get capabilities of wave output device. */
     memset(&wcaps, 0, sizeof(wcaps));
@@ -784,63 +3834,41 @@ sss_init(HINSTANCE hinst)
         return SSSERR_OPEN_CAPS;
     }
 
-    /* Decide what format to use. */
+    /* Decide what format to use.  Floating point output keeps
+    ** the most of the mix; try it first. */
     memset(&f, 0, sizeof(f));
     wfmt = &f;
-    wfmt->wBitsPerSample = 8;
-    wfmt->wFormatTag = WAVE_FORMAT_PCM;
-    if (wcaps.dwFormats & WAVE_FORMAT_4S08)
-    {
-        /* 44.1KHz stereo 8-bit */
-        wfmt->nChannels = 2;    /* Stereo */
-        wfmt->nSamplesPerSec = 44100L;
-        wfmt->nAvgBytesPerSec = 88200L;
-        wfmt->nBlockAlign = 2;
-    }
-    else if (wcaps.dwFormats & WAVE_FORMAT_2S08)
-    {
-        /* 22.05KHz stereo 8-bit */
-        wfmt->nChannels = 2;    /* Stereo */
-        wfmt->nSamplesPerSec = 22050;
-        wfmt->nAvgBytesPerSec = 44100;
-        wfmt->nBlockAlign = 2;
-    }
-    else if (wcaps.dwFormats & WAVE_FORMAT_1S08)
-    {
-        /* 11.025KHz stereo 8-bit */
-        wfmt->nChannels = 2;    /* Stereo */
-        wfmt->nSamplesPerSec = 11025;
-        wfmt->nAvgBytesPerSec = 22050;
-        wfmt->nBlockAlign = 2;
-    }
-    else if (wcaps.dwFormats & WAVE_FORMAT_4M08)
-    {
-        /* 44.1KHz mono 8-bit */
-        wfmt->nChannels = 1;    /* Mono */
-        wfmt->nSamplesPerSec = 44100;
-        wfmt->nAvgBytesPerSec = 44100;
-        wfmt->nBlockAlign = 1;
-    }
-    else if (wcaps.dwFormats & WAVE_FORMAT_2M08)
-    {
-        /* 22.05KHz mono 8-bit */
-        wfmt->nChannels = 1;    /* Mono */
-        wfmt->nSamplesPerSec = 22050;
-        wfmt->nAvgBytesPerSec = 22050;
-        wfmt->nBlockAlign = 1;
-    }
-    else if (wcaps.dwFormats & WAVE_FORMAT_1M08)
-    {
-        /* 11.025KHz mono 8-bit */
-        wfmt->nChannels = 1;    /* Mono */
-        wfmt->nSamplesPerSec = 11025;
-        wfmt->nAvgBytesPerSec = 11025;
-        wfmt->nBlockAlign = 1;
-    }
-    else
+    wfmt->wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
+    wfmt->wBitsPerSample = 32;
+    wfmt->nChannels = 2;
+    wfmt->nSamplesPerSec = 44100;
+    wfmt->nBlockAlign = 2 * 4;
+    wfmt->nAvgBytesPerSec = 44100 * 2 * 4;
+    out_format = OUTFMT_F32;
+    if (waveOutOpen(NULL, (UINT)WAVE_MAPPER, wfmt, 0, 0,
+                    WAVE_FORMAT_QUERY) != MMSYSERR_NOERROR)
     {
-        /* No 8-bit audio formats supported! */
-        return SSSERR_OPEN_FORMAT;
+        /* No floating point; take the best PCM format
+        ** that the device says it supports. */
+        for (u = 0; u < NUM_PCM_FORMATS; u++)
+        {
+            if (wcaps.dwFormats & pcm_formats[u].caps_flag)
+                break;
+        }
+        if (u >= NUM_PCM_FORMATS)
+        {
+            /* No usable audio formats supported! */
+            return SSSERR_OPEN_FORMAT;
+        }
+
+        wfmt->wFormatTag = WAVE_FORMAT_PCM;
+        wfmt->wBitsPerSample = pcm_formats[u].bits;
+        wfmt->nChannels = pcm_formats[u].channels;
+        wfmt->nSamplesPerSec = pcm_formats[u].rate;
+        wfmt->nBlockAlign = (WORD)(pcm_formats[u].channels *
+                                   pcm_formats[u].bits / 8);
+        wfmt->nAvgBytesPerSec = pcm_formats[u].rate * wfmt->nBlockAlign;
+        out_format = (pcm_formats[u].bits == 16) ? OUTFMT_S16 : OUTFMT_U8;
     }
 
     /* Set misc. variables. */
@@ -848,8 +3876,9 @@ sss_init(HINSTANCE hinst)
     is_stereo = 0;
     if (wfmt->nChannels > 1)
         is_stereo = 1;
-    bfr_size = (UINT)(wfmt->nAvgBytesPerSec / BUFFERS_PER_SECOND);
-    bfr_size &= ~0x3;       /* DWORD boundary. */
+    bfr_frames = (UINT)(wfmt->nSamplesPerSec / BUFFERS_PER_SECOND);
+    bfr_frames &= ~0x3;     /* DWORD boundary. */
+    bfr_size = bfr_frames * wfmt->nBlockAlign;
 
     /* Open the audio output device. */
     /* NOTE:  The docs say WAVEFORMAT should be passed to
@@ -890,6 +3919,39 @@ sss_init(HINSTANCE hinst)
         return SSSERR_OPEN_DEVICE;
     }
 
+    /* Allocate the buffers for mixing. */
+    mixbus = malloc(sizeof(int) * bfr_frames * wfmt->nChannels);
+    voicebuf = malloc(sizeof(short) * bfr_frames);
+    sinc_table = malloc(sizeof(short) * SINC_BANDS * SSS_SINC_PHASES *
+                    sinc_taps);
+    chan = malloc(sizeof(CHANNEL_DESC) * num_channels);
+    active = malloc(sizeof(UINT) * num_channels);
+    if (mixbus == NULL || voicebuf == NULL || sinc_table == NULL ||
+        chan == NULL || active == NULL)
+    {
+        /* Out of memory! */
+        free_mix_buffers();
+        waveOutClose(hwaveout);
+        hwaveout = NULL;
+        return SSSERR_NO_MEMORY;
+    }
+    build_sinc_table();
+    start_workers();
+
+    /* Reset all channels. */
+    for (u = 0; u < num_channels; u++)
+    {
+        chan[u].pan_pos = SSS_PAN_CENTER;
+        chan[u].isample = IDLE;
+        chan[u].pos = 0;
+        chan[u].incr = 0;
+        chan[u].volume = SSS_MAX_VOLUME - 1;
+        chan[u].interp = SSS_INTERP_DEFAULT;
+        chan[u].listed = 0;
+        set_gains(&chan[u]);
+    }
+    num_active = 0;
+
     /* Allocate buffers for WAVEHDRs. */
     for (u = 0; u < 2; u++)
     {
@@ -901,6 +3963,7 @@ sss_init(HINSTANCE hinst)
             /* Out of memory! */
             waveOutClose(hwaveout);
             hwaveout = NULL;
+            free_mix_buffers();
             return SSSERR_NO_MEMORY;
         }
         buffers[u] = GlobalLock(hbuffers[u]);
@@ -926,6 +3989,11 @@ sss_init(HINSTANCE hinst)
     wavehdrs[0].dwFlags |= WHDR_DONE;
     wavehdrs[1].dwFlags |= WHDR_DONE;
 
+    /* Mixing starts as soon as the timer does. */
+    InitializeCriticalSection(&active_lock);
+    InitializeCriticalSection(&sample_lock);
+    InitializeCriticalSection(&music_lock);
+
     /* Start a timer. */
 #ifdef USE_MM_TIMERS
     timeBeginPeriod(5);
@@ -973,6 +4041,12 @@ sss_init(HINSTANCE hinst)
             buffers[u] = NULL;
         }
 
+        /* Discard the mixing buffers. */
+        free_mix_buffers();
+        DeleteCriticalSection(&active_lock);
+        DeleteCriticalSection(&sample_lock);
+        DeleteCriticalSection(&music_lock);
+
         /* Reset variables. */
         mixrate = 0;
         hwaveout = NULL;
@@ -1010,8 +4084,11 @@ sss_deinit(void)
         return;
     }
 
-    /* Discard music. */
+    /* Discard music, and any song still loading. */
+    load_wait();
+    EnterCriticalSection(&music_lock);
     music_stop();
+    LeaveCriticalSection(&music_lock);
     sss_music_flush();
 
     /* Kill the timer. */
@@ -1023,12 +4100,13 @@ sss_deinit(void)
 #endif /* USE_MM_TIMERS */
 
     /* Reset all channels. */
-    for (u = 0; u < SSS_MAX_CHANNELS; u++)
+    for (u = 0; u < num_channels; u++)
     {
         chan[u].pan_pos = SSS_PAN_CENTER;
         chan[u].isample = IDLE;
-        chan[u].voffset = 0;
-        chan[u].vsize = 0;
+        chan[u].pos = 0;
+        chan[u].incr = 0;
+        set_gains(&chan[u]);
     }
 
     /* Stop anything that's still playing. */
@@ -1057,6 +4135,12 @@ sss_deinit(void)
         buffers[u] = NULL;
     }
 
+    /* Discard the mixing buffers. */
+    free_mix_buffers();
+    DeleteCriticalSection(&active_lock);
+    DeleteCriticalSection(&sample_lock);
+    DeleteCriticalSection(&music_lock);
+
     /* Reset variables. */
     mixrate = 0;
     hwaveout = NULL;
@@ -1065,13 +4149,14 @@ sss_deinit(void)
     for (u = 0; u < SSS_MAX_SAMPLES; u++)
     {
         /* Does this sample have allocated memory? */
-        if (samples[u].data != NULL)
+        if (samples[u].data != NULL && samples[u].owned)
         {
             free(samples[u].data);
         }
 
         /* Mark sample as unused. */
         samples[u].data = NULL;
+        samples[u].owned = FALSE;
         samples[u].size = 0;
         samples[u].smprate = 0;
     }
@@ -1106,6 +4191,226 @@ sss_get_mixrate(void)
     return mixrate;
 }
 
+/*
+** sss_set_channels:
+** Sets how many audio channels the library mixes, and how
+** many of them are used for music.  The music uses the
+** last channels, and the rest are available for playing
+** samples.  Must be called before sss_init.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      channels Total number of channels, from 1 to
+**              SSS_MAX_CHANNELS.
+**      music   Number of channels for music, from 0 to
+**              SSS_MAX_MUSIC_CHANNELS, and no more than
+**              'channels'.
+**
+** Returns:
+**      Value                   Meaning
+**      -----                   -------
+**      SSSERR_OK               Successful.
+**      SSSERR_ALREADY_INITED   Library already initialized.
+**      SSSERR_BAD_PARAM        Invalid number of channels.
+*/
+UINT
+sss_set_channels(UINT channels, UINT music)
+{
+    if (initialized)
+        return SSSERR_ALREADY_INITED;
+
+    if (channels < 1 || channels > SSS_MAX_CHANNELS ||
+        music > SSS_MAX_MUSIC_CHANNELS || music > channels)
+        return SSSERR_BAD_PARAM;
+
+    num_channels = channels;
+    music_channels = music;
+    music_first = channels - music;
+    return SSSERR_OK;
+}
+
+/*
+** sss_set_interpolation:
+** Sets the interpolation mode used for mixing all channels
+** that don't have their own setting.  May be called before
+** sss_init.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      mode    SSS_INTERP_NEAREST, SSS_INTERP_LINEAR,
+**              SSS_INTERP_CUBIC, or SSS_INTERP_SINC.
+**
+** Returns:
+**      NONE
+*/
+void
+sss_set_interpolation(UINT mode)
+{
+    /* Check interpolation mode. */
+    if (mode >= NUM_INTERP)
+    {
+        return;
+    }
+
+    interp_mode = mode;
+}
+
+/*
+** sss_set_sinc_taps:
+** Sets the number of taps in the windowed sinc filters used by
+** SSS_INTERP_SINC.  The filters are built by sss_init, so this
+** must be called before it.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      taps    Number of taps; a multiple of 8, from 8
+**              to SSS_MAX_SINC_TAPS.
+**
+** Returns:
+**      Value                   Meaning
+**      -----                   -------
+**      SSSERR_OK               Successful.
+**      SSSERR_ALREADY_INITED   Library already initialized.
+**      SSSERR_BAD_PARAM        Invalid number of taps.
+*/
+UINT
+sss_set_sinc_taps(UINT taps)
+{
+    if (initialized)
+        return SSSERR_ALREADY_INITED;
+
+    if (taps < 8 || taps > SSS_MAX_SINC_TAPS || (taps & 7) != 0)
+        return SSSERR_BAD_PARAM;
+
+    sinc_taps = taps;
+    return SSSERR_OK;
+}
+
+/*
+** sss_set_mix_threads:
+** Sets how many threads mix the audio channels, and how many
+** channels must be playing before they're shared out among
+** them.  The threads are started by sss_init, so this must be
+** called before it.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      threads Number of threads, from 1 to
+**              SSS_MAX_MIX_THREADS, or 0 for one per CPU.
+**      threshold Least number of playing channels to split
+**              across the threads.
+**
+** Returns:
+**      Value                   Meaning
+**      -----                   -------
+**      SSSERR_OK               Successful.
+**      SSSERR_ALREADY_INITED   Library already initialized.
+**      SSSERR_BAD_PARAM        Invalid number of threads.
+*/
+UINT
+sss_set_mix_threads(UINT threads, UINT threshold)
+{
+    if (initialized)
+        return SSSERR_ALREADY_INITED;
+
+    if (threads > SSS_MAX_MIX_THREADS)
+        return SSSERR_BAD_PARAM;
+
+    mix_threads = threads;
+    mix_threshold = threshold;
+    return SSSERR_OK;
+}
+
+/*
+** sss_get_mix_load:
+** Retrieves the time spent mixing since the last call, as a
+** share of the playing time of the audio that was mixed.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      any     Load in tenths of a percent.
+*/
+UINT
+sss_get_mix_load(void)
+{
+    LARGE_INTEGER   freq;   /* Performance counter ticks per second. */
+    UINT            load;
+
+    if (!initialized || load_frames == 0)
+        return 0;
+
+    QueryPerformanceFrequency(&freq);
+    load = (UINT)((ULONGLONG)load_ticks * 1000 * mixrate /
+            ((ULONGLONG)freq.QuadPart * load_frames));
+    load_ticks = 0;
+    load_frames = 0;
+    return load;
+}
+
+/*
+** sss_get_interpolation:
+** Retrieves the interpolation mode used for mixing all
+** channels that don't have their own setting.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      any     One of the SSS_INTERP_... constants.
+*/
+UINT
+sss_get_interpolation(void)
+{
+    return interp_mode;
+}
+
+/*
+** sss_get_bits:
+** Retrieve the number of bits in each sample of the
+** audio device's output format.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      8       Unsigned 8-bit PCM.
+**      16      Signed 16-bit PCM.
+**      32      32-bit floating point.
+**      0       Library not initialized.
+*/
+UINT
+sss_get_bits(void)
+{
+    /* Make sure library was initialized. */
+    if (!initialized)
+    {
+        /* Library not initialized. */
+        return 0;
+    }
+
+    switch (out_format)
+    {
+        case OUTFMT_F32:
+            return 32;
+        case OUTFMT_S16:
+            return 16;
+        default:
+            return 8;
+    }
+}
+
 /*
 ** sss_get_channel_count:
 ** Retrieves the number of audio channels
@@ -1130,7 +4435,27 @@ sss_get_channel_count(void)
     }
 
     /* Caller gets # of channels not used for music. */
-    return SSS_MAX_CHANNELS - SSS_MUSIC_CHANNELS;
+    return music_first;
+}
+
+/*
+** sss_get_music_first:
+** Retrieves the first audio channel used for music.
+** Channels before it are available for playing samples,
+** and the music uses it and those after it.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      any     Channel number.
+*/
+UINT
+sss_get_music_first(void)
+{
+    return music_first;
 }
 
 /*
@@ -1157,7 +4482,7 @@ sss_channel_pan_set(UINT channel, UINT pan)
     }
 
     /* Check channel number. */
-    if (channel >= SSS_MAX_CHANNELS)
+    if (channel >= num_channels)
     {
         return;
     }
@@ -1170,6 +4495,7 @@ sss_channel_pan_set(UINT channel, UINT pan)
 
     /* Save new pan position. */
     chan[channel].pan_pos = pan;
+    set_gains(&chan[channel]);
 }
 
 /*
@@ -1198,7 +4524,7 @@ sss_channel_pan_get(UINT channel)
     }
 
     /* Check channel number. */
-    if (channel >= SSS_MAX_CHANNELS)
+    if (channel >= num_channels)
     {
         return SSS_PAN_CENTER;
     }
@@ -1234,7 +4560,7 @@ sss_channel_is_busy(UINT channel)
     }
 
     /* Check channel number. */
-    if (channel >= SSS_MAX_CHANNELS)
+    if (channel >= num_channels)
     {
         return 0;
     }
@@ -1269,15 +4595,15 @@ sss_channel_stop(UINT channel)
     }
 
     /* Check channel number. */
-    if (channel >= SSS_MAX_CHANNELS)
+    if (channel >= num_channels)
     {
         return;
     }
 
     /* Reset sample for this channel to idle state. */
     chan[channel].isample = IDLE;
-    chan[channel].voffset = 0;
-    chan[channel].vsize = 0;
+    chan[channel].pos = 0;
+    chan[channel].incr = 0;
 }
 
 /*
@@ -1300,25 +4626,127 @@ sss_channel_volume(UINT channel, UINT v)
     if (!initialized)
             return;
 
-    if (channel >= SSS_MAX_CHANNELS)
-            return;
+    if (channel >= num_channels)
+            return;
+
+    set_volume(&chan[channel], v);
+}
+
+/*
+** sss_channel_interpolation:
+** Sets the interpolation mode for one audio channel,
+** overriding the library setting.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      channel Channel to modify.
+**      mode    One of the SSS_INTERP_... constants, or
+**              SSS_INTERP_DEFAULT to go back to following
+**              the library setting.
+**
+** Returns:
+**      NONE
+*/
+void
+sss_channel_interpolation(UINT channel, UINT mode)
+{
+    if (!initialized)
+            return;
+
+    if (channel >= num_channels)
+            return;
+
+    if (mode >= NUM_INTERP && mode != SSS_INTERP_DEFAULT)
+            return;
+
+    chan[channel].interp = mode;
+}
+
+/*
+** sss_sample_add:
+** Adds a sample to the list of samples that may be played.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      data    Pointer to 8-bit PCM sample data.
+**      size    Size of data in bytes.
+**      loopbeg For a looping sample, the offset into the
+**              sample data to start playing each time the
+**              sample loops.
+**      loopsiz For a looping sample, how much sample data
+**              to repeat, or zero if not a looping sample.
+**      smprate Rate at which sample was recorded in Hertz.
+**      center  Flag, specifies whether samples need to be
+**              centered or not:
+**                      0 = Pre-centered sample (i.e. .SAM)
+**                      1 = Non-cnetered sample (i.e. .WAV)
+**
+** Returns:
+**      Value           Meaning
+**      -----           -------
+**      SSSERR_...      See SSSERR constants in sss.h
+**      other           Handle of new sample, a value
+**                      from zero to SSS_MAX_SAMPLES-1.
+*/
+UINT
+sss_sample_add(LPSTR data, UINT size,
+        UINT loopbeg, UINT loopsiz, UINT smprate, UINT center)
+{
+    UINT    u;
+    UINT    v;
+    LPSTR   copy;   /* The library's copy of the data. */
+
+    /* Make sure library was initialized. */
+    if (!initialized)
+    {
+        /* Library not initialized. */
+        return SSSERR_NOT_INITED;
+    }
+
+    /* Allocate memory for sample data. */
+    copy = malloc(size);
+    if (copy == NULL)
+    {
+        /* Not enough memory. */
+        return SSSERR_NO_MEMORY;
+    }
+    memcpy(copy, data, size);
+    if (center)
+    {
+        for (v = 0; v < size; v++)
+            copy[v] = copy[v] - 128;
+    }
 
-    if (v >= SSS_MAX_VOLUME)
-            v = SSS_MAX_VOLUME - 1;
-    if (v >= 0xFFFE)
-            v = 0;
+    /* Find an unused sample descriptor, and set it up. */
+    EnterCriticalSection(&sample_lock);
+    u = free_sample();
+    if (u >= SSS_MAX_SAMPLES)
+    {
+        /* All entries in samples list already used up. */
+        LeaveCriticalSection(&sample_lock);
+        free(copy);
+        return SSSERR_NO_HANDLES;
+    }
+    set_sample(&samples[u], copy, TRUE, size, loopbeg, loopsiz, smprate);
+    LeaveCriticalSection(&sample_lock);
 
-    chan[channel].volume = &volume_tables[v][0];
+    /* Caller gets sample list index (sample 'handle'). */
+    return u;
 }
 
 /*
-** sss_sample_add:
-** Adds a sample to the list of samples that may be played.
+** sss_sample_add_ref:
+** Adds a sample that plays straight from the caller's data,
+** instead of from a copy of it.  The data must already be
+** centered, and must stay where it is, unchanged, until the
+** sample is deleted.
 **
 ** Parameters:
 **      Name    Description
 **      ----    -----------
-**      data    Pointer to 8-bit PCM sample data.
+**      data    Pointer to centered 8-bit PCM sample data.
 **      size    Size of data in bytes.
 **      loopbeg For a looping sample, the offset into the
 **              sample data to start playing each time the
@@ -1326,10 +4754,6 @@ sss_channel_volume(UINT channel, UINT v)
 **      loopsiz For a looping sample, how much sample data
 **              to repeat, or zero if not a looping sample.
 **      smprate Rate at which sample was recorded in Hertz.
-**      center  Flag, specifies whether samples need to be
-**              centered or not:
-**                      0 = Pre-centered sample (i.e. .SAM)
-**                      1 = Non-cnetered sample (i.e. .WAV)
 **
 ** Returns:
 **      Value           Meaning
@@ -1339,11 +4763,10 @@ sss_channel_volume(UINT channel, UINT v)
 **                      from zero to SSS_MAX_SAMPLES-1.
 */
 UINT
-sss_sample_add(LPSTR data, UINT size,
-        UINT loopbeg, UINT loopsiz, UINT smprate, UINT center)
+sss_sample_add_ref(LPCSTR data, UINT size,
+        UINT loopbeg, UINT loopsiz, UINT smprate)
 {
     UINT    u;
-    UINT    v;
 
     /* Make sure library was initialized. */
     if (!initialized)
@@ -1352,39 +4775,18 @@ sss_sample_add(LPSTR data, UINT size,
         return SSSERR_NOT_INITED;
     }
 
-    /* Find an unused sample descriptor. */
-    u = 0;
-    while (u < SSS_MAX_SAMPLES)
-    {
-        if (samples[u].data == NULL)
-            break;
-        u++;
-    }
+    /* Find an unused sample descriptor, and set it up. */
+    EnterCriticalSection(&sample_lock);
+    u = free_sample();
     if (u >= SSS_MAX_SAMPLES)
     {
         /* All entries in samples list already used up. */
+        LeaveCriticalSection(&sample_lock);
         return SSSERR_NO_HANDLES;
     }
-
-    /* Allocate memory for sample data. */
-    samples[u].data = malloc(size);
-    if (samples[u].data == NULL)
-    {
-        /* Not enough memory. */
-        return SSSERR_NO_MEMORY;
-    }
-
-    /* Set up sample descriptor. */
-    memcpy(samples[u].data, data, size);
-    if (center)
-    {
-        for (v = 0; v < size; v++)
-            samples[u].data[v] = samples[u].data[v] - 128;
-    }
-    samples[u].size = size;
-    samples[u].smprate = smprate;
-    samples[u].loop_start = loopbeg;
-    samples[u].loop_size = loopsiz;
+    set_sample(&samples[u], (LPSTR)data, FALSE,
+        size, loopbeg, loopsiz, smprate);
+    LeaveCriticalSection(&sample_lock);
 
     /* Caller gets sample list index (sample 'handle'). */
     return u;
@@ -1421,17 +4823,23 @@ sss_sample_delete(UINT hsmp)
     }
 
     /* Is sample used? */
+    EnterCriticalSection(&sample_lock);
     if (samples[hsmp].data == NULL)
     {
         /* This sample not used. */
+        LeaveCriticalSection(&sample_lock);
         return;
     }
 
-    /* Free up the specified sample. */
-    free(samples[hsmp].data);
+    /* Free up the specified sample; data added with
+    ** sss_sample_add_ref() still belongs to the caller. */
+    if (samples[hsmp].owned)
+        free(samples[hsmp].data);
     samples[hsmp].data = NULL;
+    samples[hsmp].owned = FALSE;
     samples[hsmp].size = 0;
     samples[hsmp].smprate = 0;
+    LeaveCriticalSection(&sample_lock);
 }
 
 /*
@@ -1455,8 +4863,6 @@ sss_sample_delete(UINT hsmp)
 void
 sss_sample_play(UINT channel, UINT hsmp, UINT pitch)
 {
-    DWORD   tmpsize;
-
     /* Make sure library was initialized. */
     if (!initialized)
     {
@@ -1465,51 +4871,31 @@ sss_sample_play(UINT channel, UINT hsmp, UINT pitch)
     }
 
     /* Check channel number. */
-    if (channel >= SSS_MAX_CHANNELS)
+    if (channel >= num_channels)
     {
         /* Bogus channel number. */
         return;
     }
 
-    /* Check sample number. */
-    if (hsmp >= SSS_MAX_SAMPLES || samples[hsmp].data == NULL ||
-            samples[hsmp].smprate == 0)
+    /* Check sample number and pitch. */
+    if (hsmp >= SSS_MAX_SAMPLES || samples[hsmp].smprate == 0 || pitch == 0)
     {
         /* Bogus sample number. */
         return;
     }
 
-    /*
-    ** Stretch the sample from the assumed sampling
-    ** rate at which the sample was recorded to the
-    ** actual sampling rate that the playback system
-    ** is using.
-    */
-    tmpsize = ((long)samples[hsmp].size *
-                            (long)mixrate) /
-                            (long)samples[hsmp].smprate;
-
-    /*
-    ** Now stretch the size to match the desired
-    ** sampling rate specified by the caller.
-    */
-    tmpsize = tmpsize * (long)pitch / (long)samples[hsmp].smprate;
-
-    chan[channel].vsize = tmpsize;
-
-    /* Start the sample playing. */
-    chan[channel].isample = hsmp;
-    chan[channel].voffset = 0;
-
-    if (chan[channel].vsize < 1)
-    {
-        chan[channel].isample = IDLE;
-    }
+    /* Start the sample playing, and make sure the mixer knows
+    ** about it. */
+    start_voice(&chan[channel], hsmp, pitch_incr(hsmp, pitch));
+    if (chan[channel].isample != IDLE)
+        list_channel(channel);
 }
 
 /*
 ** sss_music_flush:
-** Removes any loaded song from memory.
+** Removes any loaded song from memory.  On the thread
+** loading a song for sss_music_load_async(), removes
+** that song instead.
 **
 ** Parameters:
 **      NONE
@@ -1521,6 +4907,7 @@ void
 sss_music_flush(void)
 {
     UINT    u;
+    MUSICSONG_DESC *psong;  /* Song to remove. */
 
     /* Make sure library was initialized. */
     if (!initialized)
@@ -1530,284 +4917,687 @@ sss_music_flush(void)
     }
 
     /* See if a song is loaded. */
-    if (song.npatterns == 0)
+    psong = def_song();
+    music_enter(psong);
+    if (psong->npatterns == 0)
+    {
+        music_leave(psong);
         return;
+    }
 
     /* Stop playing music. */
-    music_stop();
+    if (psong == &song)
+        music_stop();
 
     /* Discard the sample data. */
-    for (u = 0; u < song.nsamples; u++)
+    for (u = 0; u < psong->nsamples; u++)
+    {
+        sss_sample_delete(psong->samples[u]);
+    }
+
+    /* Discard timeline and patterns. */
+    music_forget(psong);
+    if (psong->patterns != NULL)
+        free(psong->patterns);
+    psong->patterns = NULL;
+    psong->npatterns = 0;
+    if (psong->cells != NULL)
+        free(psong->cells);
+    psong->cells = NULL;
+    psong->ncells = 0;
+    if (psong->pitches != NULL)
+        free(psong->pitches);
+    psong->pitches = NULL;
+    if (psong->notes != NULL)
+        free(psong->notes);
+    psong->notes = NULL;
+    psong->npitches = 0;
+    memset(psong->pitch_index, 0, sizeof(psong->pitch_index));
+
+    /* Discard order list. */
+    if (psong->order != NULL)
+        free(psong->order);
+    psong->order = NULL;
+    psong->norder = 0;
+
+    /* Discard samples list. */
+    if (psong->samples != NULL)
+        free(psong->samples);
+    psong->samples = NULL;
+    if (psong->finetunes != NULL)
+        free(psong->finetunes);
+    psong->finetunes = NULL;
+    if (psong->volumes != NULL)
+        free(psong->volumes);
+    psong->volumes = NULL;
+    psong->nsamples = 0;
+
+    /* Now that no sample plays from it, unmap the file. */
+    if (psong->view != NULL)
+        UnmapViewOfFile(psong->view);
+    psong->view = NULL;
+
+    /* Zero the song descriptor, in case we missed something. */
+    memset(psong, 0, sizeof(MUSICSONG_DESC));
+    music_leave(psong);
+}
+
+/*
+** sss_music_create:
+** Prepares for the definition of a new song.
+** If a song is already loaded, it will be
+** discarded.  On the thread loading a song for
+** sss_music_load_async(), this and the
+** sss_music_define_ functions build that song
+** instead, and leave the current one playing.
+**
+** Parameters:
+**      Name            Description
+**      ----            -----------
+**      npatterns       Number of patterns in song.
+**      norder          Number of entries in pattern play order list.
+**      nsamples        Number of sound samples in song.
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+UINT
+sss_music_create(UINT npatterns, UINT norder, UINT nsamples)
+{
+    UINT    u;
+    MUSICSONG_DESC *psong;  /* Song being defined. */
+
+    if (!initialized)
+        return SSSERR_NOT_INITED;
+
+    if (norder > SSS_MAX_ORDER)
+        return SSSERR_BAD_PARAM;
+
+    /* Discard any existing song. */
+    psong = def_song();
+    music_enter(psong);
+    if (psong == &song)
+        music_stop();
+    sss_music_flush();
+    music_leave(psong);
+
+    /* Allocate patterns list. */
+    psong->patterns = malloc(sizeof(MUSICPATTERN_DESC) * npatterns);
+    if (psong->patterns == NULL)
+        return SSSERR_NO_MEMORY;
+    memset(psong->patterns, 0, sizeof(MUSICPATTERN_DESC) * npatterns);
+
+    /* Allocate samples list. */
+    psong->samples = malloc(sizeof(UINT) * nsamples);
+    if (psong->samples == NULL)
+    {
+        free(psong->patterns);
+        psong->patterns = NULL;
+        return SSSERR_NO_MEMORY;
+    }
+    memset(psong->samples, 0, sizeof(UINT) * nsamples);
+    psong->finetunes = malloc(nsamples);
+    if (psong->finetunes == NULL)
+    {
+        free(psong->samples);
+        psong->samples = NULL;
+        free(psong->patterns);
+        psong->patterns = NULL;
+        return SSSERR_NO_MEMORY;
+    }
+    memset(psong->finetunes, 0, nsamples);
+    psong->volumes = malloc(nsamples);
+    if (psong->volumes == NULL)
+    {
+        free(psong->finetunes);
+        psong->finetunes = NULL;
+        free(psong->samples);
+        psong->samples = NULL;
+        free(psong->patterns);
+        psong->patterns = NULL;
+        return SSSERR_NO_MEMORY;
+    }
+    memset(psong->volumes, SSS_MAX_VOLUME - 1, nsamples);
+
+    /* Allocate play order list. */
+    psong->order = malloc(sizeof(UINT) * norder);
+    if (psong->order == NULL)
+    {
+        free(psong->volumes);
+        psong->volumes = NULL;
+        free(psong->finetunes);
+        psong->finetunes = NULL;
+        free(psong->samples);
+        psong->samples = NULL;
+        free(psong->patterns);
+        psong->patterns = NULL;
+        return SSSERR_NO_MEMORY;
+    }
+    memset(psong->order, 0, sizeof(UINT) * norder);
+
+    /* Save sizes. */
+    psong->npatterns = npatterns;
+    psong->norder = norder;
+    psong->nsamples = nsamples;
+    psong->nchannels = SSS_MUSIC_CHANNELS;
+
+    /* Periods count ticks of a PAL Amiga, unless told otherwise.
+    ** A song being loaded gets its table when it's swapped in. */
+    psong->clock = SSS_CLOCK_PAL;
+    if (psong == &song)
+        build_period_table(psong->clock);
+
+    /* Set default channel pan positions. */
+    for (u = 0; u < SSS_MAX_MUSIC_CHANNELS; u++)
     {
-        sss_sample_delete(song.samples[u]);
+        if (u % 2)
+            psong->pan_pos[u] = SSS_PAN_LEFT;
+        else
+            psong->pan_pos[u] = SSS_PAN_RIGHT;
     }
 
-    /* Discard patterns. */
-    if (song.patterns != NULL)
+    return SSSERR_OK;
+}
+
+/*
+** sss_music_define_order:
+** Sets one entry in the pattern play order list.
+**
+** Parameters:
+**      Name            Description
+**      ----            -----------
+**      iorder          Which entry in playlist to set.
+**      ipattern        Pattern to play.
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+UINT
+sss_music_define_order(UINT iorder, UINT ipattern)
+{
+    MUSICSONG_DESC  *psong; /* Song being defined. */
+
+    if (!initialized)
+        return SSSERR_NOT_INITED;
+
+    /* Make sure song has been created. */
+    psong = def_song();
+    if (psong->npatterns < 1)
+        return SSSERR_BAD_PARAM;
+
+    /* Check for bogus order index. */
+    if (iorder >= psong->norder)
+        return SSSERR_BAD_PARAM;
+    if (psong->order == NULL)
+        return SSSERR_BAD_PARAM;
+
+    /* Check for bogus pattern index. */
+    if (ipattern >= psong->npatterns)
+        return SSSERR_BAD_PARAM;
+
+    /* Set specified play order data. */
+    music_forget(psong);
+    psong->order[iorder] = ipattern;
+
+    return SSSERR_OK;
+}
+
+/*
+** sss_music_define_channels:
+** Specifies how many music channels the steps of the song
+** being created use, so the patterns only take room for
+** those.  Must be called before any patterns are defined.
+**
+** Parameters:
+**      Name            Description
+**      ----            -----------
+**      nchannels       Number of channels, from 1 to
+**                      SSS_MAX_MUSIC_CHANNELS.
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+UINT
+sss_music_define_channels(UINT nchannels)
+{
+    MUSICSONG_DESC  *psong; /* Song being defined. */
+
+    if (!initialized)
+        return SSSERR_NOT_INITED;
+
+    /* Make sure song has been created, and has no patterns yet. */
+    psong = def_song();
+    if (psong->npatterns < 1 || psong->ncells != 0)
+        return SSSERR_BAD_PARAM;
+
+    /* Check for bogus channel count. */
+    if (nchannels < 1 || nchannels > SSS_MAX_MUSIC_CHANNELS)
+        return SSSERR_BAD_PARAM;
+
+    music_forget(psong);
+    psong->nchannels = nchannels;
+
+    return SSSERR_OK;
+}
+
+/*
+** sss_music_define_pattern:
+** Specifies the size of one of the patterns in
+** the song being created.  The steps of all the
+** patterns are kept together in the song's 'cells'
+** array, which grows to make room for each one.
+**
+** Parameters:
+**      Name            Description
+**      ----            -----------
+**      ipattern        Which pattern to set up.
+**      nsteps          Number of steps in pattern.
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+UINT
+sss_music_define_pattern(UINT ipattern, UINT nsteps)
+{
+    MUSICCELL_DESC  *cells;
+    UINT            u;
+    UINT            n;      /* Number of cells in pattern. */
+    MUSICSONG_DESC  *psong; /* Song being defined. */
+
+    if (!initialized)
+        return SSSERR_NOT_INITED;
+
+    /* Make sure song has been created. */
+    psong = def_song();
+    if (psong->npatterns < 1)
+        return SSSERR_BAD_PARAM;
+
+    /* Check for bogus pattern index. */
+    if (ipattern >= psong->npatterns)
+        return SSSERR_BAD_PARAM;
+
+    music_forget(psong);
+
+    /* Make room for pattern's steps at the end of the cells.
+    ** If the pattern was already defined, its old steps are
+    ** left unused. */
+    n = nsteps * psong->nchannels;
+    if (n != 0)
     {
-        /* Discard each pattern. */
-        for (u = 0; u < song.npatterns; u++)
+        cells = realloc(psong->cells,
+                        sizeof(MUSICCELL_DESC) * (psong->ncells + n));
+        if (cells == NULL)
         {
-            if (song.patterns[u].steps != NULL)
-                free(song.patterns[u].steps);
+            return SSSERR_NO_MEMORY;
         }
-        free(song.patterns);
+        memset(&cells[psong->ncells], 0, sizeof(MUSICCELL_DESC) * n);
+        for (u = psong->ncells; u < psong->ncells + n; u++)
+            cells[u].sample = NO_SAMPLE;
+        psong->cells = cells;
     }
-    song.patterns = NULL;
-    song.npatterns = 0;
 
-    /* Discard order list. */
-    if (song.order != NULL)
-        free(song.order);
-    song.order = NULL;
-    song.norder = 0;
+    /* Save step count and place. */
+    psong->patterns[ipattern].nsteps = nsteps;
+    psong->patterns[ipattern].first = psong->ncells;
+    psong->ncells += n;
 
-    /* Discard samples list. */
-    if (song.samples != NULL)
-        free(song.samples);
-    song.samples = NULL;
-    song.nsamples = 0;
+    return SSSERR_OK;
+}
 
-    /* Zero the song descriptor, in case we missed something. */
-    memset(&song, 0, sizeof(song));
+/*
+** find_pitch:
+** Looks up a pitch in a song's table of pitches used by
+** its notes, adding it if it's not there yet, along with
+** which note of the Amiga's scale it is.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      psong   Pointer to song.
+**      pitch   Pitch to find.
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      0       Table is full, or out of memory.
+**      other   Index of pitch in song.pitches.
+*/
+static UINT
+find_pitch(MUSICSONG_DESC *psong, UINT pitch)
+{
+    UINT    u;
+    UINT    note;
+    UINT    *pitches;
+    BYTE    *notes;
+
+    /* Entry 0 stands for no note; the pitches follow it. */
+    if (psong->pitch_index[pitch] != 0)
+        return psong->pitch_index[pitch];
+    u = (psong->npitches > 0) ? psong->npitches : 1;
+    if (u > MAX_PITCHES)
+        return 0;
+
+    /* Not there; add it. */
+    pitches = realloc(psong->pitches, sizeof(UINT) * (u + 1));
+    if (pitches == NULL)
+        return 0;
+    psong->pitches = pitches;
+    notes = realloc(psong->notes, u + 1);
+    if (notes == NULL)
+        return 0;
+    psong->notes = notes;
+
+    /* Only a pitch right on the untuned scale is a note that
+    ** finetunes move; any other is played as it is. */
+    note = find_note(0, pitch);
+    if (note == NUM_NOTES || period_table[0][note] != pitch)
+        note = NO_NOTE;
+    pitches[0] = 0;
+    pitches[u] = pitch;
+    notes[0] = NO_NOTE;
+    notes[u] = (BYTE)note;
+    psong->npitches = u + 1;
+    psong->pitch_index[pitch] = (BYTE)u;
+    return u;
+}
+
+/*
+** sss_music_define_step:
+** Specifies data for one of the steps in a pattern, for
+** the first SSS_MUSIC_CHANNELS channels.
+**
+** Parameters:
+**      Name            Description
+**      ----            -----------
+**      ipattern        Which pattern to modify.
+**      istep           Which step to modify.
+**      step            Pointer to description of step.
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+UINT
+sss_music_define_step(UINT ipattern, UINT istep, const SSS_STEP_DESC *step)
+{
+    return sss_music_define_step_part(ipattern, istep, 0, step);
 }
 
 /*
-** sss_music_create:
-** Prepares for the definition of a new song.
-** If a song is already loaded, it will be
-** discarded.
+** sss_music_define_step_part:
+** Specifies data for up to SSS_MUSIC_CHANNELS of the
+** channels in one of the steps in a pattern, starting
+** at a given channel.  Only the channels the song uses
+** are kept, packed into the song's 'cells' array.
 **
 ** Parameters:
 **      Name            Description
 **      ----            -----------
-**      npatterns       Number of patterns in song.
-**      norder          Number of entries in pattern play order list.
-**      nsamples        Number of sound samples in song.
+**      ipattern        Which pattern to modify.
+**      istep           Which step to modify.
+**      first           First channel 'step' describes.
+**      step            Pointer to description of channels.
 **
 ** Returns:
 **      See SSSERR_... constants in sss.h
 */
 UINT
-sss_music_create(UINT npatterns, UINT norder, UINT nsamples)
+sss_music_define_step_part(UINT ipattern, UINT istep, UINT first,
+        const SSS_STEP_DESC *step)
 {
-    UINT    u;
+    MUSICCELL_DESC  *cell;
+    UINT            ichannel;
+    UINT            nchannels;  /* Channels in 'step' the song uses. */
+    UINT            pitch;  /* Index of note's pitch. */
+    UINT            sample; /* Index of sample, or NO_SAMPLE. */
+    MUSICSONG_DESC  *psong; /* Song being defined. */
 
     if (!initialized)
         return SSSERR_NOT_INITED;
 
-    /* Discard any existing song. */
-    music_stop();
-    sss_music_flush();
+    /* Make sure song has been created. */
+    psong = def_song();
+    if (psong->npatterns < 1)
+        return SSSERR_BAD_PARAM;
 
-    /* Allocate patterns list. */
-    song.patterns = malloc(sizeof(MUSICPATTERN_DESC) * npatterns);
-    if (song.patterns == NULL)
-        return SSSERR_NO_MEMORY;
-    memset(song.patterns, 0, sizeof(MUSICPATTERN_DESC) * npatterns);
+    /* Check for bogus pattern index. */
+    if (ipattern >= psong->npatterns)
+        return SSSERR_BAD_PARAM;
 
-    /* Allocate samples list. */
-    song.samples = malloc(sizeof(UINT) * nsamples);
-    if (song.samples == NULL)
-    {
-        free(song.patterns);
-        song.patterns = NULL;
-        return SSSERR_NO_MEMORY;
-    }
-    memset(song.samples, 0, sizeof(UINT) * nsamples);
+    /* Check for bogus step index and channel. */
+    if (istep >= psong->patterns[ipattern].nsteps ||
+        first >= psong->nchannels)
+        return SSSERR_BAD_PARAM;
+    nchannels = psong->nchannels - first;
+    if (nchannels > SSS_MUSIC_CHANNELS)
+        nchannels = SSS_MUSIC_CHANNELS;
 
-    /* Allocate play order list. */
-    song.order = malloc(sizeof(UINT) * norder);
-    if (song.order == NULL)
+    /* Check that the step fits in a packed step. */
+    for (ichannel = 0; ichannel < nchannels; ichannel++)
     {
-        free(song.samples);
-        song.samples = NULL;
-        free(song.patterns);
-        song.patterns = NULL;
-        return SSSERR_NO_MEMORY;
+        sample = step->note_sample[ichannel] & ~SSS_SAMPLE_ONLY;
+        if (((step->note_pitch[ichannel] != 0 ||
+              sample != step->note_sample[ichannel]) &&
+             sample != NO_SAMPLE && sample >= psong->nsamples) ||
+            sample > 0xFF ||
+            step->note_pitch[ichannel] > SSS_MAX_PERIOD ||
+            step->note_effect[ichannel] > 0xFF ||
+            step->note_eparam[ichannel] > 0xFF)
+            return SSSERR_BAD_PARAM;
     }
-    memset(song.order, 0, sizeof(UINT) * norder);
-
-    /* Save sizes. */
-    song.npatterns = npatterns;
-    song.norder = norder;
-    song.nsamples = nsamples;
 
-    /* Set default channel pan positions. */
-    for (u = 0; u < SSS_MUSIC_CHANNELS; u++)
+    /* Save new step data. */
+    music_forget(psong);
+    cell = &psong->cells[psong->patterns[ipattern].first +
+                       istep * psong->nchannels + first];
+    for (ichannel = 0; ichannel < nchannels; ichannel++, cell++)
     {
-        if (u % 2)
-            song.pan_pos[u] = SSS_PAN_LEFT;
-        else
-            song.pan_pos[u] = SSS_PAN_RIGHT;
+        pitch = 0;
+        if (step->note_pitch[ichannel] != 0)
+        {
+            pitch = find_pitch(psong, step->note_pitch[ichannel]);
+            if (pitch == 0)
+                return SSSERR_NO_MEMORY;
+        }
+        sample = step->note_sample[ichannel];
+        if (sample & SSS_SAMPLE_ONLY)
+            sample &= ~SSS_SAMPLE_ONLY;
+        else if (pitch == 0)
+            sample = NO_SAMPLE;
+        cell->pitch = (BYTE)pitch;
+        cell->sample = (BYTE)sample;
+        cell->effect = (BYTE)step->note_effect[ichannel];
+        cell->eparam = (BYTE)step->note_eparam[ichannel];
     }
 
     return SSSERR_OK;
 }
 
 /*
-** sss_music_define_order:
-** Sets one entry in the pattern play order list.
+** sss_music_define_sample:
+** Specifies which sample handle to use for one of the
+** samples in the current song.
 **
 ** Parameters:
-**      Name            Description
-**      ----            -----------
-**      iorder          Which entry in playlist to set.
-**      ipattern        Pattern to play.
+**      Name    Description
+**      ----    -----------
+**      isample Index of sample in song.
+**      hsmp    Handle of sample (from sss_sample_add).
 **
 ** Returns:
 **      See SSSERR_... constants in sss.h
 */
 UINT
-sss_music_define_order(UINT iorder, UINT ipattern)
+sss_music_define_sample(UINT isample, UINT hsmp)
 {
+    MUSICSONG_DESC  *psong; /* Song being defined. */
+
     if (!initialized)
-        return SSSERR_NOT_INITED;
+            return SSSERR_NOT_INITED;
 
     /* Make sure song has been created. */
-    if (song.npatterns < 1)
+    psong = def_song();
+    if (psong->npatterns < 1)
         return SSSERR_BAD_PARAM;
 
-    /* Check for bogus order index. */
-    if (iorder >= song.norder)
-        return SSSERR_BAD_PARAM;
-    if (song.order == NULL)
+    /* Check for bogus sample index. */
+    if (isample > psong->nsamples)
         return SSSERR_BAD_PARAM;
 
-    /* Check for bogus pattern index. */
-    if (ipattern >= song.npatterns)
+    /* Check for bogus sample handle. */
+    if (hsmp >= SSS_MAX_SAMPLES)
+        return SSSERR_BAD_PARAM;
+    if (samples[hsmp].data == NULL)
         return SSSERR_BAD_PARAM;
 
-    /* Set specified play order data. */
-    song.order[iorder] = ipattern;
+    /* Save it. */
+    music_forget(psong);
+    psong->samples[isample] = hsmp;
 
     return SSSERR_OK;
 }
 
 /*
-** sss_music_define_pattern:
-** Specifies the size of one of the patterns in
-** the song being created.
+** sss_music_define_finetune:
+** Specifies the finetune of one of the samples in the
+** current song.
 **
 ** Parameters:
 **      Name            Description
 **      ----            -----------
-**      ipattern        Which pattern to set up.
-**      nsteps          Number of steps in pattern.
+**      isample         Index of sample in song.
+**      finetune        Finetune, -8 to +7.
 **
 ** Returns:
 **      See SSSERR_... constants in sss.h
 */
 UINT
-sss_music_define_pattern(UINT ipattern, UINT nsteps)
+sss_music_define_finetune(UINT isample, int finetune)
 {
+    MUSICSONG_DESC  *psong; /* Song being defined. */
+
     if (!initialized)
         return SSSERR_NOT_INITED;
 
     /* Make sure song has been created. */
-    if (song.npatterns < 1)
+    psong = def_song();
+    if (psong->npatterns < 1)
         return SSSERR_BAD_PARAM;
 
-    /* Check for bogus pattern index. */
-    if (ipattern >= song.npatterns)
+    /* Check for bogus sample index and finetune. */
+    if (isample >= psong->nsamples || finetune < -8 || finetune > 7)
         return SSSERR_BAD_PARAM;
 
-    /* Discard pattern if it is already defined. */
-    if (song.patterns[ipattern].steps != NULL)
-    {
-        free(song.patterns[ipattern].steps);
-        song.patterns[ipattern].steps = NULL;
-        song.patterns[ipattern].nsteps = 0;
-    }
-
-    /* Allocate memory for pattern's steps. */
-    song.patterns[ipattern].steps = malloc(sizeof(SSS_STEP_DESC) * nsteps);
-    if (song.patterns[ipattern].steps == NULL)
-    {
-        return SSSERR_NO_MEMORY;
-    }
-    memset(song.patterns[ipattern].steps, 0, sizeof(SSS_STEP_DESC) * nsteps);
-
-    /* Save step count. */
-    song.patterns[ipattern].nsteps = nsteps;
+    /* Save it, as the row of period_table it picks. */
+    music_forget(psong);
+    psong->finetunes[isample] = (BYTE)(finetune & 0x0F);
 
     return SSSERR_OK;
 }
 
 /*
-** sss_music_define_step:
-** Specifies data for one of the steps in a pattern.
+** sss_music_define_volume:
+** Specifies the volume that notes of one of the samples in
+** the current song start at.
 **
 ** Parameters:
 **      Name            Description
 **      ----            -----------
-**      ipattern        Which pattern to modify.
-**      istep           Which step to modify.
-**      step            Pointer to description of step.
+**      isample         Index of sample in song.
+**      volume          Volume, 0..SSS_MAX_VOLUME-1.
 **
 ** Returns:
 **      See SSSERR_... constants in sss.h
 */
 UINT
-sss_music_define_step(UINT ipattern, UINT istep, const SSS_STEP_DESC *step)
+sss_music_define_volume(UINT isample, UINT volume)
 {
+    MUSICSONG_DESC  *psong; /* Song being defined. */
+
     if (!initialized)
         return SSSERR_NOT_INITED;
 
     /* Make sure song has been created. */
-    if (song.npatterns < 1)
-        return SSSERR_BAD_PARAM;
-
-    /* Check for bogus pattern index. */
-    if (ipattern > song.npatterns)
+    psong = def_song();
+    if (psong->npatterns < 1)
         return SSSERR_BAD_PARAM;
 
-    /* Check for bogus step index. */
-    if (istep > song.patterns[ipattern].nsteps)
+    /* Check for bogus sample index and volume. */
+    if (isample >= psong->nsamples || volume >= SSS_MAX_VOLUME)
         return SSSERR_BAD_PARAM;
 
-    /* Save new step data. */
-    song.patterns[ipattern].steps[istep] = *step;
+    music_forget(psong);
+    psong->volumes[isample] = (BYTE)volume;
 
     return SSSERR_OK;
 }
 
 /*
-** sss_music_define_sample:
-** Specifies which sample handle to use for one of the
-** samples in the current song.
+** sss_music_define_clock:
+** Specifies the rate of the Amiga clock that the periods
+** of the current song's notes count.
 **
 ** Parameters:
 **      Name    Description
 **      ----    -----------
-**      isample Index of sample in song.
-**      hsmp    Handle of sample (from sss_sample_add).
+**      clock   Clock rate in Hertz.
 **
 ** Returns:
 **      See SSSERR_... constants in sss.h
 */
 UINT
-sss_music_define_sample(UINT isample, UINT hsmp)
+sss_music_define_clock(UINT clock)
 {
+    MUSICSONG_DESC  *psong; /* Song being defined. */
+
     if (!initialized)
-            return SSSERR_NOT_INITED;
+        return SSSERR_NOT_INITED;
 
     /* Make sure song has been created. */
-    if (song.npatterns < 1)
+    psong = def_song();
+    if (psong->npatterns < 1)
         return SSSERR_BAD_PARAM;
 
-    /* Check for bogus sample index. */
-    if (isample > song.nsamples)
+    if (clock == 0)
         return SSSERR_BAD_PARAM;
 
-    /* Check for bogus sample handle. */
-    if (hsmp >= SSS_MAX_SAMPLES)
-        return SSSERR_BAD_PARAM;
-    if (samples[hsmp].data == NULL)
+    /* Save it, and work out the steps of the periods for it. */
+    music_forget(psong);
+    psong->clock = clock;
+    if (psong == &song)
+        build_period_table(psong->clock);
+
+    return SSSERR_OK;
+}
+
+/*
+** sss_music_define_view:
+** Hands the current song a view of a mapped file that its
+** samples were added from with sss_sample_add_ref().  The
+** song unmaps the view when it is discarded, after its
+** samples.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      view    Base address from MapViewOfFile().
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+UINT
+sss_music_define_view(LPVOID view)
+{
+    MUSICSONG_DESC  *psong; /* Song being defined. */
+
+    if (!initialized)
+        return SSSERR_NOT_INITED;
+
+    /* Make sure song has been created, and has no view yet. */
+    psong = def_song();
+    if (psong->npatterns < 1 || psong->view != NULL || view == NULL)
         return SSSERR_BAD_PARAM;
 
-    /* Save it. */
-    song.samples[isample] = hsmp;
+    psong->view = view;
 
     return SSSERR_OK;
 }
@@ -1823,7 +5613,7 @@ sss_music_define_sample(UINT isample, UINT hsmp)
 **      Name    Description
 **      ----    -----------
 **      ch      Music channel to set pan position for,
-**              0..SSS_MUSIC_CHANNELS-1.
+**              0..SSS_MAX_MUSIC_CHANNELS-1.
 **      pan     Pan position (see sss.h for constants).
 **
 ** Returns:
@@ -1832,11 +5622,11 @@ sss_music_define_sample(UINT isample, UINT hsmp)
 void
 sss_music_define_pan(UINT ch, UINT pan)
 {
-    if (ch >= SSS_MUSIC_CHANNELS)
+    if (ch >= SSS_MAX_MUSIC_CHANNELS)
         return;
     if (pan > SSS_PAN_RIGHT)
         return;
-    song.pan_pos[ch] = pan;
+    def_song()->pan_pos[ch] = pan;
 }
 
 /*
@@ -1860,6 +5650,9 @@ sss_music_command(UINT cmd)
     if (!initialized)
         return;
 
+    /* Commands are carried out between buffers, not while the
+    ** timer thread is mixing or swapping in a new song. */
+    EnterCriticalSection(&music_lock);
     switch(cmd)
     {
         case SSS_CMD_MUSIC_PLAY:
@@ -1880,9 +5673,9 @@ sss_music_command(UINT cmd)
             song.playmode = PLAYMODE_PAUSED;
 
             /* Silence channels that were used for music. */
-            for (u = 0; u < SSS_MUSIC_CHANNELS; u++)
+            for (u = 0; u < music_channels; u++)
             {
-                sss_channel_stop(SSS_MUSIC_FIRST + u);
+                sss_channel_stop(music_first + u);
             }
 
             break;
@@ -1890,15 +5683,174 @@ sss_music_command(UINT cmd)
         case SSS_CMD_MUSIC_REWIND:
             if (song.npatterns < 1)
                 break;
+            if (song.rows == NULL)
+                music_play();
             song.playmode = PLAYMODE_REWINDING;
             break;
 
         case SSS_CMD_MUSIC_FASTFORWARD:
             if (song.npatterns < 1)
                 break;
+            if (song.rows == NULL)
+                music_play();
             song.playmode = PLAYMODE_FASTFORWARDING;
             break;
     }
+    LeaveCriticalSection(&music_lock);
+}
+
+/*
+** sss_music_seek:
+** Moves playback of the current song to a given time.
+** The notes that would be sounding at that time carry on
+** from there, just as if the song had been played from the
+** start.  If the music is stopped, it is left paused there,
+** so SSS_CMD_MUSIC_PLAY carries on from that time.  Waits
+** for any buffer being mixed to be finished first.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      ms      Time from the start of the song, in
+**              milliseconds.
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+UINT
+sss_music_seek(DWORD ms)
+{
+    ULONGLONG   t;          /* Time in samples. */
+    UINT        u;
+    UINT        result;
+
+    if (!initialized)
+        return SSSERR_NOT_INITED;
+
+    /* The channels are moved between buffers, not while the
+    ** timer thread is mixing them. */
+    EnterCriticalSection(&music_lock);
+    result = SSSERR_OK;
+
+    t = (ULONGLONG)ms * mixrate / 1000;
+    if (song.npatterns < 1)
+    {
+        /* No song is loaded. */
+        result = SSSERR_BAD_PARAM;
+    }
+    else if (!music_timeline() || !music_keyframes())
+    {
+        /* No room to work out when its steps play. */
+        result = SSSERR_NO_MEMORY;
+    }
+    else if (t > 0xFFFFFFFF ||
+             (t >= song.length && song.loop_row >= song.nrows))
+    {
+        /* The song has ended by then. */
+        result = SSSERR_BAD_PARAM;
+    }
+    else
+    {
+        /* If stopped, set up as music_play() would, but paused. */
+        if (song.playmode == PLAYMODE_STOPPED)
+        {
+            for (u = 0; u < music_channels; u++)
+            {
+                sss_channel_pan_set(music_first + u, song.pan_pos[u]);
+            }
+            song.playmode = PLAYMODE_PAUSED;
+        }
+
+        /* Set the channels playing as they would be then. */
+        if (music_locate((DWORD)t))
+            song_counter = (DWORD)t;
+        else
+            result = SSSERR_BAD_PARAM;
+    }
+
+    LeaveCriticalSection(&music_lock);
+    return result;
+}
+
+/*
+** sss_music_analyze:
+** Works out how the current song plays, without playing it:
+** how long it is, whether and where it loops, and which
+** entries of its order list are ever reached.  This is
+** all in the song's timeline, so it costs no more than
+** building that, and doesn't disturb the song if it is
+** playing.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      info    Pointer to struct to fill in.
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+UINT
+sss_music_analyze(SSS_SONG_INFO *info)
+{
+    UINT    iorder;
+    UINT    irow;
+    UINT    nsteps;     /* Steps in the patterns in order list. */
+    UINT    result;
+
+    if (!initialized)
+        return SSSERR_NOT_INITED;
+    if (info == NULL)
+        return SSSERR_BAD_PARAM;
+
+    /* The timeline is built on the current song, which the
+    ** timer thread may swap for a new one between buffers. */
+    EnterCriticalSection(&music_lock);
+    result = SSSERR_OK;
+
+    /* Make sure a song is loaded, and it has steps to play. */
+    nsteps = 0;
+    for (iorder = 0; iorder < song.norder; iorder++)
+    {
+        nsteps += song.patterns[song.order[iorder]].nsteps;
+    }
+    if (song.npatterns < 1 || nsteps == 0)
+    {
+        /* Nothing to play. */
+        result = SSSERR_BAD_PARAM;
+    }
+    else if (!music_timeline())
+    {
+        /* No room to follow the song through. */
+        result = SSSERR_NO_MEMORY;
+    }
+    else
+    {
+        memset(info, 0, sizeof(SSS_SONG_INFO));
+        info->length = (DWORD)((ULONGLONG)song.length * 1000 / mixrate);
+        info->nsteps = song.nrows;
+        if (song.loop_row < song.nrows)
+        {
+            info->loops = 1;
+            info->loop_order = song.rows[song.loop_row].iorder;
+            info->loop_step = song.rows[song.loop_row].istep;
+            info->loop_time = (DWORD)((ULONGLONG)
+                    song.rows[song.loop_row].time * 1000 / mixrate);
+        }
+
+        /* Note which entries of the order list are played. */
+        info->norder = song.norder;
+        for (irow = 0; irow < song.nrows; irow++)
+        {
+            if (!info->reached[song.rows[irow].iorder])
+            {
+                info->reached[song.rows[irow].iorder] = 1;
+                info->nreached++;
+            }
+        }
+    }
+
+    LeaveCriticalSection(&music_lock);
+    return result;
 }
 
 /*
@@ -1916,7 +5868,11 @@ sss_music_state(void)
 {
     UINT state = SSS_STATE_MUSIC_STOPPED;
 
+    if (!initialized)
+        return SSS_STATE_MUSIC_NOSONGLOADED;
+
     /* Determine current state of music system. */
+    EnterCriticalSection(&music_lock);
     if (song.playmode == PLAYMODE_PLAYING)
         state = SSS_STATE_MUSIC_PLAYING;
     else if (song.playmode == PLAYMODE_STOPPED)
@@ -1930,6 +5886,7 @@ sss_music_state(void)
 
     if (song.npatterns < 1)
         state = SSS_STATE_MUSIC_NOSONGLOADED;
+    LeaveCriticalSection(&music_lock);
 
     return state;
 }
@@ -1958,6 +5915,7 @@ sss_music_get_position(UINT *ipat, UINT *istep, UINT *iorder, UINT *norder,
     if (!initialized)
         return;
 
+    EnterCriticalSection(&music_lock);
     if (ipat != NULL)
         *ipat = song.ipattern;
     if (istep != NULL)
@@ -1968,5 +5926,108 @@ sss_music_get_position(UINT *ipat, UINT *istep, UINT *iorder, UINT *norder,
         *norder = song.norder;
     if (rawpos != NULL)
         *rawpos = song.song_pos;
+    LeaveCriticalSection(&music_lock);
+}
+
+
+/*
+** sss_music_load_async:
+** Starts loading a MOD type music file on a thread of its
+** own, while the current song carries on playing.  When the
+** song is loaded, it replaces the current song between two
+** buffers of audio, stopped, and then 'done' is called on
+** the loading thread.  Starting another load cancels this
+** one.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      fn      Pathname of file to load.
+**      done    Function to call when the load is over,
+**              or NULL.
+**      param   Value to pass to 'done'.
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+UINT
+sss_music_load_async(LPSTR fn, SSS_LOAD_CALLBACK done, LPVOID param)
+{
+    LOAD_JOB    *job;
+    size_t      len;
+
+    if (!initialized)
+        return SSSERR_NOT_INITED;
+
+    len = (fn != NULL) ? strlen(fn) : 0;
+    if (len == 0 || len >= MAX_PATH)
+        return SSSERR_BAD_PARAM;
+
+    /* Only one load at a time. */
+    load_wait();
+
+    job = malloc(sizeof(LOAD_JOB));
+    if (job == NULL)
+        return SSSERR_NO_MEMORY;
+    memset(job, 0, sizeof(LOAD_JOB));
+    memcpy(job->fn, fn, len + 1);
+    job->done = done;
+    job->param = param;
+
+    job->swapped = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (job->swapped != NULL)
+        job->thread = CreateThread(NULL, 0, load_worker, job, 0, NULL);
+    if (job->thread == NULL)
+    {
+        if (job->swapped != NULL)
+            CloseHandle(job->swapped);
+        free(job);
+        return SSSERR_NO_MEMORY;
+    }
+
+    load_job = job;
+    return SSSERR_OK;
+}
+
+/*
+** sss_music_load_cancel:
+** Cancels the load started by sss_music_load_async(), if it
+** hasn't finished.  Its 'done' function is still called, with
+** SSSERR_CANCELLED, once the loading thread has cleaned up.
+** If the song has already been swapped in, it stays.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      NONE
+*/
+void
+sss_music_load_cancel(void)
+{
+    if (!initialized || load_job == NULL)
+        return;
+
+    load_cancel(load_job);
+}
+
+/*
+** sss_music_load_cancelled:
+** Tells a loader running for sss_music_load_async() whether
+** its load has been cancelled.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      TRUE    The load was cancelled.
+**      FALSE   It wasn't, or this isn't a loading thread.
+*/
+BOOL
+sss_music_load_cancelled(void)
+{
+    return def_job != NULL && def_job->cancel;
 }
 
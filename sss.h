@@ -46,22 +46,35 @@ DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
 
 /**************************** CONSTANTS ***************************/
 
-/* Number of volume level setting (range 0 to MAX_VOLUME-1) */
-#define SSS_MAX_VOLUME  16
+/*
+** Number of volume level settings (range 0 to MAX_VOLUME-1);
+** the same as the 0..64 volume range of MOD files.
+*/
+#define SSS_MAX_VOLUME  65
 
-/* Stereo pan positions for audio channels. */
+/* Stereo pan positions for audio channels, in 256 fine steps. */
 #define SSS_PAN_LEFT    0
-#define SSS_PAN_CENTER  (SSS_MAX_VOLUME / 2)
-#define SSS_PAN_RIGHT   (SSS_MAX_VOLUME - 1)
+#define SSS_PAN_CENTER  128
+#define SSS_PAN_RIGHT   256
 
 /*
 **  Number of discreet software audio channels,
 **  total of both music and sound effects channels.
+**  The number used is set by sss_set_channels, up
+**  to SSS_MAX_CHANNELS.
+*/
+#define SSS_DEFAULT_CHANNELS    36
+#define SSS_MAX_CHANNELS        256
+
+/*
+** Maximum number of audio channels used for music.
 */
-#define SSS_MAX_CHANNELS        12
+#define SSS_MAX_MUSIC_CHANNELS  32
 
 /*
-** Number of audio channels used for music.
+** Number of channels in each step of a song, unless it
+** asks for more with sss_music_define_channels, and in
+** each SSS_STEP_DESC.
 */
 #define SSS_MUSIC_CHANNELS      8
 
@@ -70,13 +83,41 @@ DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
 ** Prior channels are available for
 ** sound effects.
 */
-#define SSS_MUSIC_FIRST (SSS_MAX_CHANNELS - SSS_MUSIC_CHANNELS)
+#define SSS_MUSIC_FIRST (sss_get_music_first())
 
 /*
 ** Maximum number of samples simultaneously loaded.
 */
 #define SSS_MAX_SAMPLES 64
 
+/*
+** Maximum number of entries in a song's pattern order list.
+*/
+#define SSS_MAX_ORDER   256
+
+/*
+** Interpolation modes for fetching sample data between sample
+** points, via sss_set_interpolation and sss_channel_interpolation.
+** Better quality costs more mixing time per voice.
+*/
+#define SSS_INTERP_NEAREST      0       /* Nearest sample; cheapest. */
+#define SSS_INTERP_LINEAR       1       /* Straight line between samples. */
+#define SSS_INTERP_CUBIC        2       /* Catmull-Rom spline. */
+#define SSS_INTERP_SINC         3       /* Windowed sinc; best. */
+#define SSS_INTERP_DEFAULT      0xFF    /* Channel follows library setting. */
+
+/* Number of taps in the SSS_INTERP_SINC filters, via sss_set_sinc_taps. */
+#define SSS_DEFAULT_SINC_TAPS   16
+#define SSS_MAX_SINC_TAPS       32
+
+/*
+** Mixing threads, via sss_set_mix_threads.  Voices are split
+** across the threads only when at least the threshold number
+** of channels are playing; below that one thread is faster.
+*/
+#define SSS_MAX_MIX_THREADS     16
+#define SSS_DEFAULT_MIX_THRESHOLD 64
+
 /* Error return codes (must be positive and large values). */
 #define SSSERR_OK               0xFFFF  /* No error. */
 #define SSSERR_ALREADY_INITED   0xFFFE  /* Can't initialize library twice. */
@@ -90,13 +131,93 @@ DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
 #define SSSERR_BAD_PARAM        0xFFF6  /* Invalid parameter specified. */
 #define SSSERR_OPEN_FILE        0xFFF5  /* Failed opening a file. */
 #define SSSERR_READ_FILE        0xFFF4  /* Failed reading from a file. */
+#define SSSERR_CANCELLED        0xFFF3  /* Load was cancelled. */
 
 /* Types of effects used in steps in a pattern: */
 #define SSS_EFFECT_NONE                 0
-#define SSS_EFFECT_PATTERN_BREAK        1
-#define SSS_EFFECT_JUMP                 2
-#define SSS_EFFECT_SET_TEMPO            3
-#define SSS_EFFECT_SET_VOLUME           4
+#define SSS_EFFECT_PATTERN_BREAK        1       /* Param:  step to start next pattern at. */
+#define SSS_EFFECT_JUMP                 2       /* Param:  order entry to play next. */
+#define SSS_EFFECT_SET_TEMPO            3       /* Param:  speed, or beats per minute. */
+#define SSS_EFFECT_SET_VOLUME           4       /* Param:  volume, 0 to 64. */
+#define SSS_EFFECT_ARPEGGIO             5       /* Param:  two intervals, in half steps. */
+#define SSS_EFFECT_SLIDE_UP             6       /* Param:  periods per tick. */
+#define SSS_EFFECT_SLIDE_DOWN           7       /* Param:  periods per tick. */
+#define SSS_EFFECT_SLIDE_TO_NOTE        8       /* Param:  periods per tick. */
+#define SSS_EFFECT_VIBRATO              9       /* Param:  speed and depth. */
+#define SSS_EFFECT_VOLUME_SLIDE         10      /* Param:  volume up or down per tick. */
+#define SSS_EFFECT_SAMPLE_OFFSET        11      /* Param:  where to start note, in 256 bytes. */
+#define SSS_EFFECT_NOTE_CUT             12      /* Param:  tick to silence note at. */
+#define SSS_EFFECT_NOTE_DELAY           13      /* Param:  tick to start note at. */
+#define SSS_EFFECT_RETRIGGER            14      /* Param:  ticks between restarts of note. */
+#define SSS_EFFECT_PATTERN_LOOP         15      /* Param:  0 marks start, or times to go back. */
+#define SSS_EFFECT_PATTERN_DELAY        16      /* Param:  extra times to play step's ticks. */
+
+/*
+** The effects after SET_VOLUME work tick by tick; each step of
+** a pattern is played as 'speed' ticks.  A SET_TEMPO param from
+** 1 to SSS_MIN_BPM-1 sets the speed; a bigger one sets the beats
+** per minute, with ticks 2.5/bpm seconds apart.  Songs start at
+** speed 6 and 125 beats per minute, 50 ticks a second.
+** In the params, "high" means the high 4 bits and "low" the
+** low 4 bits.
+**
+**   ARPEGGIO       Plays the note at its own pitch, then the
+**                  high interval above it, then the low
+**                  interval above it, one tick each, over and
+**                  over.
+**   SLIDE_UP       Raises the pitch of the note each tick.
+**   SLIDE_DOWN     Lowers the pitch of the note each tick.
+**   SLIDE_TO_NOTE  Slides the pitch of the note playing toward
+**                  the note given in the step, instead of
+**                  starting the new note.  Zero keeps the last
+**                  speed used on the channel.
+**   VIBRATO        Wobbles the pitch; high is how fast, low
+**                  how far, up to twice low periods each
+**                  way.  Zero in either keeps its last setting.
+**   VOLUME_SLIDE   Raises the volume by high each tick, or if
+**                  that is zero, lowers it by low.
+**   SAMPLE_OFFSET  Starts the note in the step that far into
+**                  its sample.  Zero uses the last offset
+**                  used on the channel.
+**   NOTE_CUT       Silences the note at that tick.
+**   NOTE_DELAY     Holds back the note in the step until that
+**                  tick.
+**   RETRIGGER      Starts the note playing again every so many
+**                  ticks.
+**   PATTERN_LOOP   Zero marks a step in the pattern; then a
+**                  later step with a param goes back to it that
+**                  many times, each channel with its own loop.
+**   PATTERN_DELAY  Plays the ticks of the step that many more
+**                  times, without starting its notes again.
+**
+** The ticks of a step, and notes started on them, are timed to
+** the sample, not to when the mixer runs.
+**
+** The pitches of notes in a song are Amiga periods, as in MOD
+** files:  how many ticks of the Amiga's clock go by between
+** samples of the note, so bigger is lower.  428 is middle C.
+** Arpeggios go up the periods of the notes as the Amiga plays
+** them, for the finetune of the note's sample.
+*/
+#define SSS_MAX_PERIOD                  4095
+
+/* Smallest SET_TEMPO param that is beats per minute. */
+#define SSS_MIN_BPM                     32
+
+/* Clock rates of the Amiga in Hertz, that periods count ticks of. */
+#define SSS_CLOCK_PAL                   3546895
+#define SSS_CLOCK_NTSC                  3579545
+
+/*
+** Values for the samples in a SSS_STEP_DESC.  A note given with
+** SSS_NO_SAMPLE plays the last sample given on its channel, at
+** the volume the channel has.  A sample given with no pitch is
+** left out, as it was before, unless it has SSS_SAMPLE_ONLY
+** added to it; then it becomes the channel's sample, for the
+** notes after it, and sets the channel to its volume.
+*/
+#define SSS_NO_SAMPLE                   0xFF
+#define SSS_SAMPLE_ONLY                 0x100
 
 /* Commands for the music system, via sss_music_command: */
 #define SSS_CMD_MUSIC_PLAY              1
@@ -118,10 +239,12 @@ DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
 /* Struct used to describe one step of music. */
 typedef struct
 {
-    /* Pitch of note to play on each channel (or 0 for none). */
+    /* Pitch of note to play on each channel, as an Amiga period
+    ** up to SSS_MAX_PERIOD (or 0 for none). */
     UINT    note_pitch[SSS_MUSIC_CHANNELS];
 
-    /* Sample index of sample to play on each channel. */
+    /* Sample index of sample to play on each channel, or
+    ** SSS_NO_SAMPLE; see above. */
     UINT    note_sample[SSS_MUSIC_CHANNELS];
 
     /* Type of effect for each channel. */
@@ -131,6 +254,56 @@ typedef struct
     UINT    note_eparam[SSS_MUSIC_CHANNELS];
 } SSS_STEP_DESC;
 
+/* Struct used to report on a song, via sss_music_analyze. */
+typedef struct
+{
+    /* Time to play the song once through, in milliseconds. */
+    DWORD   length;
+
+    /* Number of steps played once through. */
+    UINT    nsteps;
+
+    /* Nonzero if the song goes back to an earlier step, by a
+    ** position jump or a pattern break, and so never ends. */
+    UINT    loops;
+
+    /* Where the song goes back to, if it loops:  entry in
+    ** order list, step in pattern, and milliseconds from the
+    ** start of the song that step is first played at. */
+    UINT    loop_order;
+    UINT    loop_step;
+    DWORD   loop_time;
+
+    /* Number of entries in the order list, and how many of
+    ** them are ever played. */
+    UINT    norder;
+    UINT    nreached;
+
+    /* Nonzero for each entry in the order list that is played. */
+    BYTE    reached[SSS_MAX_ORDER];
+} SSS_SONG_INFO;
+
+/* Struct used to report how long each phase of loading a MOD
+** file took, via sss_music_get_load_times.  All times are in
+** microseconds; phases that weren't reached are zero. */
+typedef struct
+{
+    DWORD   open;           /* Opening and mapping the file. */
+    DWORD   header;         /* Reading the header, creating song. */
+    DWORD   patterns;       /* Decoding the patterns. */
+    DWORD   samples;        /* Adding the samples. */
+    DWORD   total;          /* All of the above. */
+} SSS_LOAD_TIMES;
+
+/*
+** Function called when a load started by sss_music_load_async()
+** is over, with one of the SSSERR_ constants and the value given
+** to sss_music_load_async().  It is called on the loading thread,
+** so it should just pass the result on (i.e. with PostMessage)
+** and not call back into the library.
+*/
+typedef void (CALLBACK *SSS_LOAD_CALLBACK)(UINT result, LPVOID param);
+
 /**************************** FUNCTIONS ***************************/
 
 /*
@@ -176,6 +349,162 @@ void    sss_deinit(void);
 */
 UINT    sss_get_mixrate(void);
 
+/*
+** sss_set_channels:
+** Sets how many audio channels the library mixes, and how
+** many of them are used for music.  The music uses the
+** last channels, and the rest are available for playing
+** samples.  Must be called before sss_init.  The default
+** is SSS_DEFAULT_CHANNELS channels, SSS_MAX_MUSIC_CHANNELS of
+** them for music.  Only channels that are playing cost
+** any mixing time.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      channels Total number of channels, from 1 to
+**              SSS_MAX_CHANNELS.
+**      music   Number of channels for music, from 0 to
+**              SSS_MAX_MUSIC_CHANNELS, and no more than
+**              'channels'.
+**
+** Returns:
+**      Value                   Meaning
+**      -----                   -------
+**      SSSERR_OK               Successful.
+**      SSSERR_ALREADY_INITED   Library already initialized.
+**      SSSERR_BAD_PARAM        Invalid number of channels.
+*/
+UINT    sss_set_channels(UINT channels, UINT music);
+
+/*
+** sss_set_interpolation:
+** Sets the interpolation mode used for mixing all channels
+** that don't have their own setting.  May be called before
+** sss_init.  The default is SSS_INTERP_NEAREST.
+**
+** Measured mixing cost per voice per output frame, in TSC
+** cycles on an x64 CPU with AVX2 mixing kernels:
+**
+**      Mode                    Cycles
+**      ----                    ------
+**      SSS_INTERP_NEAREST      ~2.5
+**      SSS_INTERP_LINEAR       ~4
+**      SSS_INTERP_CUBIC        ~7
+**      SSS_INTERP_SINC         ~9 with 16 taps
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      mode    SSS_INTERP_NEAREST, SSS_INTERP_LINEAR,
+**              SSS_INTERP_CUBIC, or SSS_INTERP_SINC.
+**
+** Returns:
+**      NONE
+*/
+void    sss_set_interpolation(UINT mode);
+
+/*
+** sss_set_sinc_taps:
+** Sets the number of taps in the windowed sinc filters used by
+** SSS_INTERP_SINC.  More taps give a sharper cutoff and cost
+** more mixing time.  The filters are built by sss_init, so
+** this must be called before it.  The default is
+** SSS_DEFAULT_SINC_TAPS.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      taps    Number of taps; a multiple of 8, from 8
+**              to SSS_MAX_SINC_TAPS.
+**
+** Returns:
+**      Value                   Meaning
+**      -----                   -------
+**      SSSERR_OK               Successful.
+**      SSSERR_ALREADY_INITED   Library already initialized.
+**      SSSERR_BAD_PARAM        Invalid number of taps.
+*/
+UINT    sss_set_sinc_taps(UINT taps);
+
+/*
+** sss_set_mix_threads:
+** Sets how many threads mix the audio channels.  Each buffer
+** of audio is mixed by the library's own thread plus a pool
+** of worker threads, each taking a share of the playing
+** channels.  The result is the same no matter how many
+** threads mix it.  Must be called before sss_init.  The
+** default is one thread per CPU, used when at least
+** SSS_DEFAULT_MIX_THRESHOLD channels are playing.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      threads Number of threads, from 1 to
+**              SSS_MAX_MIX_THREADS, or 0 for one per CPU.
+**      threshold Least number of playing channels to split
+**              across the threads; with fewer, the library's
+**              own thread mixes them all.
+**
+** Returns:
+**      Value                   Meaning
+**      -----                   -------
+**      SSSERR_OK               Successful.
+**      SSSERR_ALREADY_INITED   Library already initialized.
+**      SSSERR_BAD_PARAM        Invalid number of threads.
+*/
+UINT    sss_set_mix_threads(UINT threads, UINT threshold);
+
+/*
+** sss_get_mix_load:
+** Retrieves how busy mixing has kept the library since the
+** last call: the time spent mixing, as a share of the
+** playing time of the audio that was mixed.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      any     Load in tenths of a percent; 1000 means
+**              mixing only just keeps up with playback.
+*/
+UINT    sss_get_mix_load(void);
+
+/*
+** sss_get_interpolation:
+** Retrieves the interpolation mode used for mixing all
+** channels that don't have their own setting.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      any     One of the SSS_INTERP_... constants.
+*/
+UINT    sss_get_interpolation(void);
+
+/*
+** sss_get_bits:
+** Retrieve the number of bits in each sample of the
+** audio device's output format.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      8       Unsigned 8-bit PCM.
+**      16      Signed 16-bit PCM.
+**      32      32-bit floating point.
+**      0       Library not initialized.
+*/
+UINT    sss_get_bits(void);
+
 /*
 ** sss_get_channel_count:
 ** Retrieves the number of audio channels
@@ -191,6 +520,22 @@ UINT    sss_get_mixrate(void);
 */
 UINT    sss_get_channel_count(void);
 
+/*
+** sss_get_music_first:
+** Retrieves the first audio channel used for music.
+** Channels before it are available for playing samples,
+** and the music uses it and those after it.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      any     Channel number.
+*/
+UINT    sss_get_music_first(void);
+
 /*
 ** sss_channel_pan_set:
 ** Sets the pan position of an audio channel.
@@ -272,6 +617,24 @@ void    sss_channel_stop(UINT channel);
 */
 void    sss_channel_volume(UINT channel, UINT v);
 
+/*
+** sss_channel_interpolation:
+** Sets the interpolation mode for one audio channel,
+** overriding the library setting.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      channel Channel to modify.
+**      mode    One of the SSS_INTERP_... constants, or
+**              SSS_INTERP_DEFAULT to go back to following
+**              the library setting.
+**
+** Returns:
+**      NONE
+*/
+void    sss_channel_interpolation(UINT channel, UINT mode);
+
 /*
 ** sss_sample_add:
 ** Adds a sample to the list of samples that may be played.
@@ -302,6 +665,35 @@ void    sss_channel_volume(UINT channel, UINT v);
 UINT    sss_sample_add(LPSTR data, UINT size,
                 UINT loopbeg, UINT loopsiz, UINT smprate, UINT center);
 
+/*
+** sss_sample_add_ref:
+** Adds a sample that plays straight from the caller's data,
+** instead of from a copy of it.  The data must already be
+** centered, and must stay where it is, unchanged, until the
+** sample is deleted.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      data    Pointer to centered 8-bit PCM sample data.
+**      size    Size of data in bytes.
+**      loopbeg For a looping sample, the offset into the
+**              sample data to start playing each time the
+**              sample loops.
+**      loopsiz For a looping sample, how much sample data
+**              to repeat, or zero if not a looping sample.
+**      smprate Rate at which sample was recorded in Hertz.
+**
+** Returns:
+**      Value           Meaning
+**      -----           -------
+**      SSSERR_...      See SSSERR constants above.
+**      other           Handle of new sample, a value
+**                      from zero to SSS_MAX_SAMPLES-1.
+*/
+UINT    sss_sample_add_ref(LPCSTR data, UINT size,
+                UINT loopbeg, UINT loopsiz, UINT smprate);
+
 /*
 ** sss_sample_delete:
 ** Deletes a sample that was previously added
@@ -374,7 +766,8 @@ void    sss_music_flush(void);
 **      Name            Description
 **      ----            -----------
 **      npatterns       Number of patterns in song.
-**      norder          Number of entries in pattern play order list.
+**      norder          Number of entries in pattern play order list
+**                      (at most SSS_MAX_ORDER).
 **      nsamples        Number of sound samples in song.
 **
 ** Returns:
@@ -397,6 +790,26 @@ UINT    sss_music_create(UINT npatterns, UINT norder, UINT nsamples);
 */
 UINT    sss_music_define_order(UINT iorder, UINT ipattern);
 
+/*
+** sss_music_define_channels:
+** Specifies how many music channels the steps of the
+** song being created use, so its patterns only take
+** room for those.  Must be called before any patterns
+** are defined.  The default is SSS_MUSIC_CHANNELS;
+** the steps of songs with more are defined with
+** sss_music_define_step_part.
+**
+** Parameters:
+**      Name            Description
+**      ----            -----------
+**      nchannels       Number of channels, from 1 to
+**                      SSS_MAX_MUSIC_CHANNELS.
+**
+** Returns:
+**      See SSSERR_... constants above.
+*/
+UINT    sss_music_define_channels(UINT nchannels);
+
 /*
 ** sss_music_define_pattern:
 ** Specifies the size of one of the patterns in
@@ -415,7 +828,11 @@ UINT    sss_music_define_pattern(UINT ipattern, UINT nsteps);
 
 /*
 ** sss_music_define_step:
-** Specifies data for one of the steps in a pattern.
+** Specifies data for one of the steps in a pattern, for
+** its first SSS_MUSIC_CHANNELS channels.  Sample indexes,
+** effects and effect parameters must be under 256, and a
+** song may have notes of up to 255 different pitches, none
+** over SSS_MAX_PERIOD.
 **
 ** Parameters:
 **      Name            Description
@@ -429,6 +846,29 @@ UINT    sss_music_define_pattern(UINT ipattern, UINT nsteps);
 */
 UINT    sss_music_define_step(UINT ipattern, UINT istep, const SSS_STEP_DESC *step);
 
+/*
+** sss_music_define_step_part:
+** Specifies data for one of the steps in a pattern, for
+** up to SSS_MUSIC_CHANNELS of its channels from 'first'
+** on:  entry 0 of the arrays in 'step' is channel 'first'.
+** Songs with more channels than a SSS_STEP_DESC holds
+** define each step a part at a time.  The limits are
+** those of sss_music_define_step.
+**
+** Parameters:
+**      Name            Description
+**      ----            -----------
+**      ipattern        Which pattern to modify.
+**      istep           Which step to modify.
+**      first           First channel 'step' describes.
+**      step            Pointer to description of channels.
+**
+** Returns:
+**      See SSSERR_... constants above.
+*/
+UINT    sss_music_define_step_part(UINT ipattern, UINT istep, UINT first,
+                const SSS_STEP_DESC *step);
+
 /*
 ** sss_music_define_sample:
 ** Specifies which sample handle to use for one of the
@@ -445,6 +885,78 @@ UINT    sss_music_define_step(UINT ipattern, UINT istep, const SSS_STEP_DESC *st
 */
 UINT    sss_music_define_sample(UINT isample, UINT hsmp);
 
+/*
+** sss_music_define_finetune:
+** Specifies the finetune of one of the samples in the
+** current song, as in a MOD file:  how many eighths of a
+** half step its notes are played above or below their
+** pitch.  Notes that are on the Amiga's scale are moved to
+** the tuned period for that note, the same as an Amiga
+** plays them.  The default is zero.
+**
+** Parameters:
+**      Name            Description
+**      ----            -----------
+**      isample         Index of sample in song.
+**      finetune        Finetune, -8 to +7.
+**
+** Returns:
+**      See SSSERR_... constants above.
+*/
+UINT    sss_music_define_finetune(UINT isample, int finetune);
+
+/*
+** sss_music_define_volume:
+** Specifies the volume that notes of one of the samples in
+** the current song start at, as in a MOD file.  Notes that
+** slide to a new pitch keep the volume of the note they
+** slide from.  The default is SSS_MAX_VOLUME-1.
+**
+** Parameters:
+**      Name            Description
+**      ----            -----------
+**      isample         Index of sample in song.
+**      volume          Volume, 0..SSS_MAX_VOLUME-1.
+**
+** Returns:
+**      See SSSERR_... constants above.
+*/
+UINT    sss_music_define_volume(UINT isample, UINT volume);
+
+/*
+** sss_music_define_clock:
+** Specifies the rate of the Amiga clock that the periods
+** of the current song's notes count.  The default is
+** SSS_CLOCK_PAL.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      clock   Clock rate in Hertz; SSS_CLOCK_PAL or
+**              SSS_CLOCK_NTSC.
+**
+** Returns:
+**      See SSSERR_... constants above.
+*/
+UINT    sss_music_define_clock(UINT clock);
+
+/*
+** sss_music_define_view:
+** Hands the current song a view of a mapped file that its
+** samples were added from with sss_sample_add_ref(), so
+** that the file stays mapped for as long as they play.
+** The song unmaps the view when it is discarded.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      view    Base address from MapViewOfFile().
+**
+** Returns:
+**      See SSSERR_... constants above.
+*/
+UINT    sss_music_define_view(LPVOID view);
+
 /*
 ** sss_music_define_pan:
 ** Specifies the initial stereo pan position for
@@ -456,7 +968,7 @@ UINT    sss_music_define_sample(UINT isample, UINT hsmp);
 **      Name    Description
 **      ----    -----------
 **      ch      Music channel to set pan position for,
-**              0..SSS_MUSIC_CHANNELS-1.
+**              0..SSS_MAX_MUSIC_CHANNELS-1.
 **      pan     Pan position (see sss.h for constants).
 **
 ** Returns:
@@ -464,6 +976,57 @@ UINT    sss_music_define_sample(UINT isample, UINT hsmp);
 */
 void    sss_music_define_pan(UINT ch, UINT pan);
 
+/*
+** sss_music_seek:
+** Moves playback of the current song to a given time.
+** The song's position jumps and pattern breaks are
+** followed, and a song that loops keeps going round, so
+** any time is somewhere in it unless the song ends
+** first.  Notes started before that time that would still
+** be sounding carry on from where they would have got to.
+** If the music is stopped, it is left paused at that time,
+** so SSS_CMD_MUSIC_PLAY carries on from there.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      ms      Time from the start of the song, in
+**              milliseconds.
+**
+** Returns:
+**      Value                   Meaning
+**      -----                   -------
+**      SSSERR_OK               Successful.
+**      SSSERR_NOT_INITED       Library not initialized.
+**      SSSERR_BAD_PARAM        No song loaded, or the song
+**                              ends before that time.
+**      SSSERR_NO_MEMORY        Out of memory.
+*/
+UINT    sss_music_seek(DWORD ms);
+
+/*
+** sss_music_analyze:
+** Works out how the current song plays, without playing it:
+** how long it is, whether and where it loops, and which
+** entries of its order list are ever reached.  Doesn't
+** disturb the song if it is playing.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      info    Pointer to struct to fill in.
+**
+** Returns:
+**      Value                   Meaning
+**      -----                   -------
+**      SSSERR_OK               Successful.
+**      SSSERR_NOT_INITED       Library not initialized.
+**      SSSERR_BAD_PARAM        No song loaded, or it has
+**                              no steps to play.
+**      SSSERR_NO_MEMORY        Out of memory.
+*/
+UINT    sss_music_analyze(SSS_SONG_INFO *info);
+
 /*
 ** sss_music_state:
 ** Retrieves the current state of the music system.
@@ -492,3 +1055,88 @@ void    sss_music_get_position(UINT *ipat, UINT *istep,
 */
 UINT    sss_music_load_mod(LPSTR fn);
 
+/*
+** sss_music_load_mod_mem:
+** Loads a MOD type music file from memory, such as one
+** embedded in the program or taken from an archive.  The
+** song keeps copies of the samples, so the caller may free
+** the data as soon as this returns.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      data    Pointer to the bytes of the file.
+**      len     Size of the file in bytes.
+**
+** Returns:
+**      See SSSERR_... constants above.
+*/
+UINT    sss_music_load_mod_mem(const void *data, size_t len);
+
+/*
+** sss_music_get_load_times:
+** Retrieves how long each phase of the last MOD load took,
+** whether it succeeded or not.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      times   Pointer to struct to fill in.
+**
+** Returns:
+**      NONE
+*/
+void    sss_music_get_load_times(SSS_LOAD_TIMES *times);
+
+/*
+** sss_music_load_async:
+** Starts loading a MOD type music file on a thread of its
+** own, while the current song carries on playing.  When the
+** song is loaded, it replaces the current song between two
+** buffers of audio, stopped, and then 'done' is called.
+** Starting another load cancels this one.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      fn      Pathname of file to load.
+**      done    Function to call when the load is over,
+**              or NULL.
+**      param   Value to pass to 'done'.
+**
+** Returns:
+**      See SSSERR_... constants above.
+*/
+UINT    sss_music_load_async(LPSTR fn, SSS_LOAD_CALLBACK done, LPVOID param);
+
+/*
+** sss_music_load_cancel:
+** Cancels the load started by sss_music_load_async(), if
+** it hasn't finished; its 'done' function is then called
+** with SSSERR_CANCELLED.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      NONE
+*/
+void    sss_music_load_cancel(void);
+
+/*
+** sss_music_load_cancelled:
+** Tells a loader running for sss_music_load_async() whether
+** its load has been cancelled, so it can give up between
+** the phases of building the song.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      TRUE    The load was cancelled.
+**      FALSE   It wasn't, or this isn't a loading thread.
+*/
+BOOL    sss_music_load_cancelled(void);
+
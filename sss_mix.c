@@ -0,0 +1,656 @@
+/*
+--------------------------------------------------------------------
+
+sss_mix.c
+
+C functions for the mixing kernels used internally by the
+Simple Sound System library: scaling voices into the mix bus
+and converting the mix bus to the output format, in plain C,
+SSE2 and AVX2 versions.  All versions give identical results.
+
+--------------------------------------------------------------------
+
+(C) Copyright 1993,1995 Ammon R. Campbell.
+
+I wrote this code for use in my own educational and experimental
+programs, but you may also freely use it in yours as long as you
+abide by the following terms and conditions:
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+  * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+  * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials
+    provided with the distribution.
+  * The name(s) of the author(s) and contributors (if any) may not
+    be used to endorse or promote products derived from this
+    software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.  
+
+--------------------------------------------------------------------
+*/
+
+/**************************** INCLUDES ****************************/
+
+#define STRICT
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sss_mix.h"
+
+/*
+** If USE_SIMD is defined, the SSE2 and AVX2 kernels are compiled
+** in.  This is only possible for x86 and x64 targets.
+*/
+#if defined(_M_IX86) || defined(_M_X64)
+#define USE_SIMD
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+/************************* LOCAL FUNCTIONS ************************/
+
+/*
+** Plain C kernels.  These are used on CPUs without SSE2, and
+** by the SIMD kernels to finish off the last few samples of a
+** buffer that don't fill a whole vector.
+*/
+
+static void
+scalar_accum_mono(int *bus, const short *src, UINT frames, int gain)
+{
+    UINT    u;
+
+    for (u = 0; u < frames; u++)
+        bus[u] += ((int)src[u] * gain) >> SSS_GAIN_SHIFT;
+}
+
+static void
+scalar_accum_stereo(int *bus, const short *src, UINT frames,
+        int gain_l, int gain_r)
+{
+    UINT    u;
+
+    for (u = 0; u < frames; u++)
+    {
+        bus[u * 2] += ((int)src[u] * gain_l) >> SSS_GAIN_SHIFT;
+        bus[u * 2 + 1] += ((int)src[u] * gain_r) >> SSS_GAIN_SHIFT;
+    }
+}
+
+static void
+scalar_pack_u8(unsigned char *out, const int *bus, UINT count)
+{
+    UINT    u;
+    int     ival;
+
+    for (u = 0; u < count; u++)
+    {
+        ival = bus[u] >> SSS_BUS_SHIFT_8;
+        if (ival < -128)
+            ival = -128;
+        else if (ival > 127)
+            ival = 127;
+        out[u] = (unsigned char)(ival + 128);
+    }
+}
+
+static void
+scalar_pack_s16(short *out, const int *bus, UINT count)
+{
+    UINT    u;
+    int     ival;
+
+    for (u = 0; u < count; u++)
+    {
+        ival = bus[u] >> SSS_BUS_SHIFT_16;
+        if (ival < -32768)
+            ival = -32768;
+        else if (ival > 32767)
+            ival = 32767;
+        out[u] = (short)ival;
+    }
+}
+
+static void
+scalar_pack_f32(float *out, const int *bus, UINT count)
+{
+    UINT    u;
+    float   fval;
+
+    for (u = 0; u < count; u++)
+    {
+        fval = (float)bus[u] * SSS_BUS_SCALE_F32;
+        if (fval < -1.0f)
+            fval = -1.0f;
+        else if (fval > 1.0f)
+            fval = 1.0f;
+        out[u] = fval;
+    }
+}
+
+static void
+scalar_resample_sinc(short *dst, const signed char *src, ULONGLONG pos,
+        ULONGLONG incr, UINT frames, const short *table, UINT taps)
+{
+    UINT        u;
+    UINT        k;
+    int         ival;
+    const signed char *s;
+    const short *t;
+
+    for (u = 0; u < frames; u++)
+    {
+        s = src + (UINT)(pos >> 32);
+        t = table + ((DWORD)pos >> (32 - SSS_SINC_PHASE_BITS)) * taps;
+        ival = 0;
+        for (k = 0; k < taps; k++)
+            ival += s[k] * t[k];
+        ival >>= SSS_GAIN_SHIFT;
+        if (ival < -32768)
+            ival = -32768;
+        else if (ival > 32767)
+            ival = 32767;
+        dst[u] = (short)ival;
+        pos += incr;
+    }
+}
+
+#ifdef USE_SIMD
+
+/*
+** SSE2 kernels.  Eight frames per pass.  The 16x16 bit
+** products are formed from the low and high halves given by
+** _mm_mullo_epi16 and _mm_mulhi_epi16, since SSE2 has no
+** 32-bit multiply.
+*/
+
+static void
+sse2_accum_mono(int *bus, const short *src, UINT frames, int gain)
+{
+    UINT    u;
+    __m128i g;
+    __m128i s, lo, hi;
+
+    g = _mm_set1_epi16((short)gain);
+    for (u = 0; u + 8 <= frames; u += 8)
+    {
+        s = _mm_loadu_si128((const __m128i *)&src[u]);
+        lo = _mm_mullo_epi16(s, g);
+        hi = _mm_mulhi_epi16(s, g);
+        _mm_storeu_si128((__m128i *)&bus[u],
+                _mm_add_epi32(_mm_loadu_si128((const __m128i *)&bus[u]),
+                    _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), SSS_GAIN_SHIFT)));
+        _mm_storeu_si128((__m128i *)&bus[u + 4],
+                _mm_add_epi32(_mm_loadu_si128((const __m128i *)&bus[u + 4]),
+                    _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), SSS_GAIN_SHIFT)));
+    }
+    scalar_accum_mono(&bus[u], &src[u], frames - u, gain);
+}
+
+static void
+sse2_accum_stereo(int *bus, const short *src, UINT frames,
+        int gain_l, int gain_r)
+{
+    UINT    u;
+    __m128i g;
+    __m128i s, d, lo, hi;
+    int     *pb;
+
+    /* Gains alternate left, right to match the bus layout. */
+    g = _mm_set1_epi32((gain_r << 16) | (gain_l & 0xFFFF));
+    for (u = 0; u + 8 <= frames; u += 8)
+    {
+        s = _mm_loadu_si128((const __m128i *)&src[u]);
+        pb = &bus[u * 2];
+
+        /* First four frames. */
+        d = _mm_unpacklo_epi16(s, s);
+        lo = _mm_mullo_epi16(d, g);
+        hi = _mm_mulhi_epi16(d, g);
+        _mm_storeu_si128((__m128i *)&pb[0],
+                _mm_add_epi32(_mm_loadu_si128((const __m128i *)&pb[0]),
+                    _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), SSS_GAIN_SHIFT)));
+        _mm_storeu_si128((__m128i *)&pb[4],
+                _mm_add_epi32(_mm_loadu_si128((const __m128i *)&pb[4]),
+                    _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), SSS_GAIN_SHIFT)));
+
+        /* Last four frames. */
+        d = _mm_unpackhi_epi16(s, s);
+        lo = _mm_mullo_epi16(d, g);
+        hi = _mm_mulhi_epi16(d, g);
+        _mm_storeu_si128((__m128i *)&pb[8],
+                _mm_add_epi32(_mm_loadu_si128((const __m128i *)&pb[8]),
+                    _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), SSS_GAIN_SHIFT)));
+        _mm_storeu_si128((__m128i *)&pb[12],
+                _mm_add_epi32(_mm_loadu_si128((const __m128i *)&pb[12]),
+                    _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), SSS_GAIN_SHIFT)));
+    }
+    scalar_accum_stereo(&bus[u * 2], &src[u], frames - u, gain_l, gain_r);
+}
+
+static void
+sse2_pack_u8(unsigned char *out, const int *bus, UINT count)
+{
+    UINT    u;
+    __m128i a, b, c, d;
+    __m128i bias;
+
+    bias = _mm_set1_epi8((char)0x80);
+    for (u = 0; u + 16 <= count; u += 16)
+    {
+        a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)&bus[u]), SSS_BUS_SHIFT_8);
+        b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)&bus[u + 4]), SSS_BUS_SHIFT_8);
+        c = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)&bus[u + 8]), SSS_BUS_SHIFT_8);
+        d = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)&bus[u + 12]), SSS_BUS_SHIFT_8);
+
+        /* Saturate down to signed bytes, then uncenter. */
+        a = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i *)&out[u], _mm_xor_si128(a, bias));
+    }
+    scalar_pack_u8(&out[u], &bus[u], count - u);
+}
+
+static void
+sse2_pack_s16(short *out, const int *bus, UINT count)
+{
+    UINT    u;
+    __m128i a, b;
+
+    for (u = 0; u + 8 <= count; u += 8)
+    {
+        a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)&bus[u]),
+                SSS_BUS_SHIFT_16);
+        b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)&bus[u + 4]),
+                SSS_BUS_SHIFT_16);
+        _mm_storeu_si128((__m128i *)&out[u], _mm_packs_epi32(a, b));
+    }
+    scalar_pack_s16(&out[u], &bus[u], count - u);
+}
+
+static void
+sse2_pack_f32(float *out, const int *bus, UINT count)
+{
+    UINT    u;
+    __m128  scale, lo, hi;
+    __m128  a;
+
+    scale = _mm_set1_ps(SSS_BUS_SCALE_F32);
+    lo = _mm_set1_ps(-1.0f);
+    hi = _mm_set1_ps(1.0f);
+    for (u = 0; u + 4 <= count; u += 4)
+    {
+        a = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)&bus[u]));
+        a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(a, scale), lo), hi);
+        _mm_storeu_ps(&out[u], a);
+    }
+    scalar_pack_f32(&out[u], &bus[u], count - u);
+}
+
+static void
+sse2_resample_sinc(short *dst, const signed char *src, ULONGLONG pos,
+        ULONGLONG incr, UINT frames, const short *table, UINT taps)
+{
+    UINT        u;
+    UINT        k;
+    const signed char *s;
+    const short *t;
+    __m128i     acc;
+    __m128i     a;
+
+    for (u = 0; u < frames; u++)
+    {
+        s = src + (UINT)(pos >> 32);
+        t = table + ((DWORD)pos >> (32 - SSS_SINC_PHASE_BITS)) * taps;
+        acc = _mm_setzero_si128();
+        for (k = 0; k < taps; k += 8)
+        {
+            /* Sign extend eight points to 16 bits, then
+            ** multiply by the taps and add in pairs. */
+            a = _mm_loadl_epi64((const __m128i *)&s[k]);
+            a = _mm_srai_epi16(_mm_unpacklo_epi8(a, a), 8);
+            acc = _mm_add_epi32(acc,
+                    _mm_madd_epi16(a, _mm_loadu_si128((const __m128i *)&t[k])));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4E));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xB1));
+        acc = _mm_srai_epi32(acc, SSS_GAIN_SHIFT);
+        dst[u] = (short)_mm_cvtsi128_si32(_mm_packs_epi32(acc, acc));
+        pos += incr;
+    }
+}
+
+/*
+** AVX2 kernels.  Sixteen frames per pass.  Samples are
+** sign extended to 32 bits and multiplied directly.
+*/
+
+static void
+avx2_accum_mono(int *bus, const short *src, UINT frames, int gain)
+{
+    UINT    u;
+    __m256i g;
+    __m256i s;
+
+    g = _mm256_set1_epi32(gain);
+    for (u = 0; u + 16 <= frames; u += 16)
+    {
+        s = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&src[u]));
+        _mm256_storeu_si256((__m256i *)&bus[u],
+                _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&bus[u]),
+                    _mm256_srai_epi32(_mm256_mullo_epi32(s, g), SSS_GAIN_SHIFT)));
+        s = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&src[u + 8]));
+        _mm256_storeu_si256((__m256i *)&bus[u + 8],
+                _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&bus[u + 8]),
+                    _mm256_srai_epi32(_mm256_mullo_epi32(s, g), SSS_GAIN_SHIFT)));
+    }
+    scalar_accum_mono(&bus[u], &src[u], frames - u, gain);
+}
+
+static void
+avx2_accum_stereo(int *bus, const short *src, UINT frames,
+        int gain_l, int gain_r)
+{
+    UINT    u;
+    UINT    half;
+    __m256i g;
+    __m256i s, d;
+    __m256i dup_lo, dup_hi;
+    int     *pb;
+
+    /* Gains alternate left, right to match the bus layout. */
+    g = _mm256_set_epi32(gain_r, gain_l, gain_r, gain_l,
+                         gain_r, gain_l, gain_r, gain_l);
+
+    /* Lane orders that duplicate each frame for left and right. */
+    dup_lo = _mm256_set_epi32(3, 3, 2, 2, 1, 1, 0, 0);
+    dup_hi = _mm256_set_epi32(7, 7, 6, 6, 5, 5, 4, 4);
+
+    for (u = 0; u + 16 <= frames; u += 16)
+    {
+        for (half = 0; half < 16; half += 8)
+        {
+            s = _mm256_cvtepi16_epi32(
+                    _mm_loadu_si128((const __m128i *)&src[u + half]));
+            pb = &bus[(u + half) * 2];
+
+            d = _mm256_permutevar8x32_epi32(s, dup_lo);
+            _mm256_storeu_si256((__m256i *)&pb[0],
+                    _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&pb[0]),
+                        _mm256_srai_epi32(_mm256_mullo_epi32(d, g), SSS_GAIN_SHIFT)));
+            d = _mm256_permutevar8x32_epi32(s, dup_hi);
+            _mm256_storeu_si256((__m256i *)&pb[8],
+                    _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&pb[8]),
+                        _mm256_srai_epi32(_mm256_mullo_epi32(d, g), SSS_GAIN_SHIFT)));
+        }
+    }
+    scalar_accum_stereo(&bus[u * 2], &src[u], frames - u, gain_l, gain_r);
+}
+
+static void
+avx2_pack_u8(unsigned char *out, const int *bus, UINT count)
+{
+    UINT    u;
+    __m256i a, b, c, d;
+    __m256i bias;
+    __m256i order;
+
+    bias = _mm256_set1_epi8((char)0x80);
+
+    /* The packs work within 128-bit lanes; this puts the
+    ** resulting dwords back in sample order. */
+    order = _mm256_set_epi32(7, 3, 6, 2, 5, 1, 4, 0);
+
+    for (u = 0; u + 32 <= count; u += 32)
+    {
+        a = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)&bus[u]), SSS_BUS_SHIFT_8);
+        b = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)&bus[u + 8]), SSS_BUS_SHIFT_8);
+        c = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)&bus[u + 16]), SSS_BUS_SHIFT_8);
+        d = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)&bus[u + 24]), SSS_BUS_SHIFT_8);
+
+        a = _mm256_packs_epi16(_mm256_packs_epi32(a, b),
+                               _mm256_packs_epi32(c, d));
+        a = _mm256_permutevar8x32_epi32(a, order);
+        _mm256_storeu_si256((__m256i *)&out[u], _mm256_xor_si256(a, bias));
+    }
+    sse2_pack_u8(&out[u], &bus[u], count - u);
+}
+
+static void
+avx2_pack_s16(short *out, const int *bus, UINT count)
+{
+    UINT    u;
+    __m256i a, b;
+
+    for (u = 0; u + 16 <= count; u += 16)
+    {
+        a = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)&bus[u]),
+                SSS_BUS_SHIFT_16);
+        b = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i *)&bus[u + 8]),
+                SSS_BUS_SHIFT_16);
+
+        /* Put the 64-bit halves back in order after the
+        ** in-lane pack. */
+        a = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+        _mm256_storeu_si256((__m256i *)&out[u], a);
+    }
+    sse2_pack_s16(&out[u], &bus[u], count - u);
+}
+
+static void
+avx2_pack_f32(float *out, const int *bus, UINT count)
+{
+    UINT    u;
+    __m256  scale, lo, hi;
+    __m256  a;
+
+    scale = _mm256_set1_ps(SSS_BUS_SCALE_F32);
+    lo = _mm256_set1_ps(-1.0f);
+    hi = _mm256_set1_ps(1.0f);
+    for (u = 0; u + 8 <= count; u += 8)
+    {
+        a = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)&bus[u]));
+        a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(a, scale), lo), hi);
+        _mm256_storeu_ps(&out[u], a);
+    }
+    sse2_pack_f32(&out[u], &bus[u], count - u);
+}
+
+static void
+avx2_resample_sinc(short *dst, const signed char *src, ULONGLONG pos,
+        ULONGLONG incr, UINT frames, const short *table, UINT taps)
+{
+    UINT        u;
+    UINT        k;
+    const signed char *s;
+    const short *t;
+    __m256i     acc;
+    __m128i     sum;
+
+    for (u = 0; u < frames; u++)
+    {
+        s = src + (UINT)(pos >> 32);
+        t = table + ((DWORD)pos >> (32 - SSS_SINC_PHASE_BITS)) * taps;
+        acc = _mm256_setzero_si256();
+        for (k = 0; k + 16 <= taps; k += 16)
+        {
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(
+                    _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)&s[k])),
+                    _mm256_loadu_si256((const __m256i *)&t[k])));
+        }
+        sum = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                _mm256_extracti128_si256(acc, 1));
+        if (k < taps)
+        {
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(
+                    _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i *)&s[k])),
+                    _mm_loadu_si128((const __m128i *)&t[k])));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+        sum = _mm_srai_epi32(sum, SSS_GAIN_SHIFT);
+        dst[u] = (short)_mm_cvtsi128_si32(_mm_packs_epi32(sum, sum));
+        pos += incr;
+    }
+}
+
+/*
+** cpu_features:
+** Determines which SIMD instruction sets can be used,
+** checking both the CPU and that the OS saves the AVX
+** registers.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      0       No SIMD kernels usable.
+**      1       SSE2 usable.
+**      2       SSE2 and AVX2 usable.
+*/
+static UINT
+cpu_features(void)
+{
+    int     regs[4];    /* EAX, EBX, ECX, EDX from cpuid. */
+    int     maxleaf;
+    UINT    level = 0;
+
+    __cpuid(regs, 0);
+    maxleaf = regs[0];
+    if (maxleaf < 1)
+        return 0;
+
+    __cpuid(regs, 1);
+    if (regs[3] & (1 << 26))
+        level = 1;                      /* SSE2 */
+
+    /* AVX2 needs the OSXSAVE and AVX bits, YMM state enabled
+    ** by the OS, and the AVX2 bit in leaf 7. */
+    if (level == 1 && maxleaf >= 7 &&
+        (regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) &&
+        (_xgetbv(0) & 6) == 6)
+    {
+        __cpuidex(regs, 7, 0);
+        if (regs[1] & (1 << 5))
+            level = 2;                  /* AVX2 */
+    }
+
+    return level;
+}
+
+#endif /* USE_SIMD */
+
+/**************************** DATA ********************************/
+
+const SSS_MIX_KERNELS sss_mix_scalar =
+{
+    "scalar",
+    scalar_accum_mono,
+    scalar_accum_stereo,
+    scalar_pack_u8,
+    scalar_pack_s16,
+    scalar_pack_f32,
+    scalar_resample_sinc
+};
+
+#ifdef USE_SIMD
+const SSS_MIX_KERNELS sss_mix_sse2 =
+{
+    "sse2",
+    sse2_accum_mono,
+    sse2_accum_stereo,
+    sse2_pack_u8,
+    sse2_pack_s16,
+    sse2_pack_f32,
+    sse2_resample_sinc
+};
+
+const SSS_MIX_KERNELS sss_mix_avx2 =
+{
+    "avx2",
+    avx2_accum_mono,
+    avx2_accum_stereo,
+    avx2_pack_u8,
+    avx2_pack_s16,
+    avx2_pack_f32,
+    avx2_resample_sinc
+};
+#else
+const SSS_MIX_KERNELS sss_mix_sse2 = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+const SSS_MIX_KERNELS sss_mix_avx2 = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+#endif /* USE_SIMD */
+
+/**************************** FUNCTIONS ***************************/
+
+/*
+** sss_mix_supported:
+** Determines if the CPU can run a set of mixing kernels.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      k       Pointer to kernel set to check.
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      1       Kernel set can be used.
+**      0       Kernel set not supported.
+*/
+UINT
+sss_mix_supported(const SSS_MIX_KERNELS *k)
+{
+    if (k == NULL || k->name == NULL)
+        return 0;
+    if (k == &sss_mix_scalar)
+        return 1;
+
+#ifdef USE_SIMD
+    if (k == &sss_mix_sse2)
+        return cpu_features() >= 1;
+    if (k == &sss_mix_avx2)
+        return cpu_features() >= 2;
+#endif /* USE_SIMD */
+
+    return 0;
+}
+
+/*
+** sss_mix_select:
+** Picks the fastest set of mixing kernels that the
+** CPU supports, using cpuid.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Pointer to selected kernel set.
+*/
+const SSS_MIX_KERNELS *
+sss_mix_select(void)
+{
+    if (sss_mix_supported(&sss_mix_avx2))
+        return &sss_mix_avx2;
+    if (sss_mix_supported(&sss_mix_sse2))
+        return &sss_mix_sse2;
+    return &sss_mix_scalar;
+}
@@ -0,0 +1,181 @@
+/*
+--------------------------------------------------------------------
+
+sss_mix.h
+
+C header file for the mixing kernels used internally by the
+Simple Sound System library.  Each set of kernels does the same
+job with a different instruction set; sss_mix_select() picks
+the fastest set the CPU supports.
+
+--------------------------------------------------------------------
+
+(C) Copyright 1993,1995 Ammon R. Campbell.
+
+I wrote this code for use in my own educational and experimental
+programs, but you may also freely use it in yours as long as you
+abide by the following terms and conditions:
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+  * Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+  * Redistributions in binary form must reproduce the above
+    copyright notice, this list of conditions and the following
+    disclaimer in the documentation and/or other materials
+    provided with the distribution.
+  * The name(s) of the author(s) and contributors (if any) may not
+    be used to endorse or promote products derived from this
+    software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.  
+
+--------------------------------------------------------------------
+*/
+
+/**************************** CONSTANTS ***************************/
+
+/*
+** Gain value that passes a sample through to the mix bus
+** at full level.  Gains are 16-bit fixed point, so this
+** leaves headroom for gains up to about 2x.
+*/
+#define SSS_GAIN_UNITY          16384
+
+/*
+** Number of bits the product of a 16-bit sample and a gain
+** is shifted right before being added to the mix bus.
+** A full scale sample at SSS_GAIN_UNITY lands on the bus
+** with 8 bits of fraction below 16-bit output resolution,
+** leaving room for hundreds of voices in 32 bits.
+*/
+#define SSS_GAIN_SHIFT          6
+
+/*
+** Number of bits the mix bus is shifted right to give 8-bit
+** and 16-bit output samples.  This leaves two bits of headroom
+** in the output, so four voices at full volume just reach
+** full scale.
+*/
+#define SSS_BUS_SHIFT_8         18
+#define SSS_BUS_SHIFT_16        10
+
+/* Factor to scale the mix bus by for floating point output. */
+#define SSS_BUS_SCALE_F32       (1.0f / (float)(1L << 25))
+
+/*
+** Number of bits of the fractional sample position used to
+** pick a phase of the windowed sinc filter, and the number of
+** phases that gives.  Each phase is a row of taps in the
+** filter table, scaled so SSS_GAIN_UNITY is 1.0.
+*/
+#define SSS_SINC_PHASE_BITS     8
+#define SSS_SINC_PHASES         (1 << SSS_SINC_PHASE_BITS)
+
+/**************************** TYPES *******************************/
+
+/* Struct used to describe one set of mixing kernels. */
+typedef struct
+{
+    /* Text name of kernel set, for reports. */
+    const char *name;
+
+    /*
+    ** Scales 'frames' 16-bit samples from 'src' by 'gain'
+    ** and adds them to a mono mix bus.
+    */
+    void (*accum_mono)(int *bus, const short *src, UINT frames,
+                int gain);
+
+    /*
+    ** Scales 'frames' 16-bit samples from 'src' by a left
+    ** and a right gain and adds them to an interleaved
+    ** stereo mix bus.
+    */
+    void (*accum_stereo)(int *bus, const short *src, UINT frames,
+                int gain_l, int gain_r);
+
+    /*
+    ** Converts 'count' values from the mix bus to unsigned
+    ** 8-bit output samples, saturating at full scale.
+    */
+    void (*pack_u8)(unsigned char *out, const int *bus, UINT count);
+
+    /*
+    ** Converts 'count' values from the mix bus to signed
+    ** 16-bit output samples, saturating at full scale.
+    */
+    void (*pack_s16)(short *out, const int *bus, UINT count);
+
+    /*
+    ** Converts 'count' values from the mix bus to floating
+    ** point output samples, clipped to -1.0..1.0.
+    */
+    void (*pack_f32)(float *out, const int *bus, UINT count);
+
+    /*
+    ** Resamples 'frames' 16-bit samples into 'dst' from 8-bit
+    ** sample data with a windowed sinc filter of 'taps' taps,
+    ** a multiple of 8.  'pos' is the 32.32 fixed point position
+    ** of the first output sample, relative to 'src', and 'incr'
+    ** the step between output samples.  Each output sample is
+    ** the dot product of the filter phase for its position with
+    ** the 'taps' points of 'src' that start at its whole position,
+    ** which must all lie within the sample data.
+    */
+    void (*resample_sinc)(short *dst, const signed char *src,
+                ULONGLONG pos, ULONGLONG incr, UINT frames,
+                const short *table, UINT taps);
+} SSS_MIX_KERNELS;
+
+/**************************** DATA ********************************/
+
+/* Kernel sets; the SIMD ones are NULL-named if not compiled in. */
+extern const SSS_MIX_KERNELS sss_mix_scalar;
+extern const SSS_MIX_KERNELS sss_mix_sse2;
+extern const SSS_MIX_KERNELS sss_mix_avx2;
+
+/**************************** FUNCTIONS ***************************/
+
+/*
+** sss_mix_supported:
+** Determines if the CPU can run a set of mixing kernels.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      k       Pointer to kernel set to check.
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      1       Kernel set can be used.
+**      0       Kernel set not supported.
+*/
+UINT    sss_mix_supported(const SSS_MIX_KERNELS *k);
+
+/*
+** sss_mix_select:
+** Picks the fastest set of mixing kernels that the
+** CPU supports, using cpuid.
+**
+** Parameters:
+**      NONE
+**
+** Returns:
+**      Pointer to selected kernel set.
+*/
+const SSS_MIX_KERNELS *sss_mix_select(void);
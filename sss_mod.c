@@ -54,7 +54,8 @@ First 20 bytes:
         22 bytes:  instrument name; null-terminated.
         2 bytes:  byte-swapped integer; number of 16-bit words of
                 sample data for this instrument.
-        1 byte:  fine-tuning; valid values are -8 to +8.
+        1 byte:  fine-tuning; the low 4 bits are -8 to +7, in eighths
+                of a half step.
         1 byte:  volume; valid values are 0 to 64.
         2 bytes:  byte-swapped integer; word offset into sample data
                 where repetition of the sample begins.
@@ -71,14 +72,19 @@ First 20 bytes:
         Pattern number of each pattern to be played
 
 4 bytes:
-        Signature, either "M.K." or "FLT4"
+        Signature:  "M.K.", "M!K!" or "FLT4" for 4 channels,
+        "xCHN" or "xxCH" for x or xx channels (up to 32), or
+        "CD81" or "OKTA" for 8 channels.  Older files have
+        only 15 instruments and no signature; their header
+        ends after the arrangement.
 
-1024 bytes for each pattern:
+1024 bytes for each pattern (256 for each channel):
         Note that number of patterns must be calculated by
         taking the file size minus the header size and sample
-        size and dividing by 1024.
-        The pattern data is 64 notes, where each note is a
-        four byte value, as follows:
+        size and dividing by the size of a pattern.
+        The pattern data is 64 steps, each with one note for
+        each channel, where each note is a four byte value,
+        as follows:
 
                 byte 0   byte 1   byte 2   byte 3
                 -------- -------- -------- --------
@@ -86,16 +92,16 @@ First 20 bytes:
 
         Where:
                 I = 8 bits of instrument number
-                P = 12 bits of note pitch
+                P = 12 bits of note pitch, as an Amiga period
                 E = effect number
                 A = effect arguments
 
         Valid effect numbers include:
 
                 0 =     Arpeggiation:  plays the note rapidly
-                        at three different pitches.  The low
+                        at three different pitches.  The high
                         nibble of "A" specifies the first interval
-                        in half-steps.  The high nibble of "A"
+                        in half-steps.  The low nibble of "A"
                         specifies the second interval.
 
                 1 =     Slide up:  Raises the note pitch during
@@ -115,6 +121,9 @@ First 20 bytes:
                         and the high niblle of "A" specifies the
                         depth.
 
+                9 =     Sample offset:  Starts the note "A"
+                        times 256 bytes into its sample.
+
                 10 =    Volume slide:  Raises or lowers the
                         volume of the note during playback.
                         If the high nibble of "A" is zero, then
@@ -137,9 +146,26 @@ First 20 bytes:
                         is used when the pattern is less than
                         64 notes long.
 
+                14 =    Extended effects:  The high nibble of "A"
+                        picks the effect, and the low nibble "x"
+                        is its parameter:
+                          6 = Pattern loop:  x = 0 marks where
+                              the loop starts, otherwise go back
+                              there x times.
+                          9 = Retrigger:  Restart the note every
+                              x ticks.
+                          C = Note cut:  Silence the note at
+                              tick x.
+                          D = Note delay:  Start the note at
+                              tick x.
+                          E = Pattern delay:  Play the step's
+                              ticks x more times.
+
                 15 =    Set speed:  Sets the playback speed
-                        for the song.  "A" specifies a speed
-                        from 0 to 31.
+                        for the song.  "A" from 1 to 31 is
+                        the number of ticks in each note; 32
+                        or more is the tempo in beats per
+                        minute.
 
                 Certain MOD editors/players have additional
                 effects that vary by implementation.
@@ -161,442 +187,553 @@ N bytes sample data:
 
 #include "sss.h"
 
-/* Valid signatures for 31-instrument MOD file headers. */
-#define MOD_SIGNATURE1  "M.K."
-#define MOD_SIGNATURE2  "FLT4"
+/* Number of steps in each pattern. */
+#define MOD_PATTERN_STEPS       64
 
-/* Number of channels in MOD file. */
-#define NUM_TRACKS      4
+/* Sizes of the parts of a MOD file, in bytes. */
+#define MOD_NAME_SIZE           20      /* Name of song. */
+#define MOD_INST_SIZE           30      /* Each instrument. */
+#define MOD_ORDER_SIZE          128     /* Arrangement. */
+#define MOD_SIGNATURE_SIZE      4       /* Signature. */
+#define MOD_NOTE_SIZE           4       /* Each note of a pattern. */
 
-/* The rate at which the samples in the MOD were recorded. */
+/* The rate at which the samples in the MOD were recorded, for
+** playing them with sss_sample_play().  Songs play them at the
+** periods of their notes instead. */
 #define MOD_RECORDED_RATE       8000
 
-/* How much to scale MOD note pitches to match our pitches. */
-#define PITCH_SCALE             18
-
-#pragma pack(1)
-
-/* Description of a note. */
+/* One layout of MOD file, told apart by its signature. */
 typedef struct
 {
-    unsigned char   b1;     /* High bits of inst # and high bits of pitch */
-    unsigned char   b2;     /* Low bits of pitch */
-    unsigned char   b3;     /* Low bits of inst # and 4-bits of effect type */
-    unsigned char   b4;     /* Effect parameters */
-} NOTE_DESC;
-
-/* Description of a pattern. */
-typedef struct
+    const char      *signature;     /* Signature, or NULL if none. */
+    UINT            ninst;          /* Number of instruments. */
+    UINT            nchannels;      /* Number of notes in each step, */
+                                    /* or 0 if the signature says. */
+} MOD_LAYOUT;
+
+/* The layouts that can be loaded.  A '#' in a signature stands
+** for a digit of the number of channels.  The last one, with no
+** signature, is the old 15-instrument kind, which is assumed
+** when none of the others match. */
+static const MOD_LAYOUT layouts[] =
 {
-    NOTE_DESC notes[NUM_TRACKS * 64];       /* Four tracks of 64 notes. */
-} PATTERN_DESC;
-
-/* Description of one instrument in a MOD file. */
-typedef struct
+    { "M.K.",   31,     4 },
+    { "M!K!",   31,     4 },
+    { "FLT4",   31,     4 },
+    { "#CHN",   31,     0 },
+    { "##CH",   31,     0 },
+    { "CD81",   31,     8 },
+    { "OKTA",   31,     8 },
+    { NULL,     15,     4 }
+};
+#define NUM_LAYOUTS     (sizeof(layouts) / sizeof(layouts[0]))
+
+/* SSS_EFFECT_... for each MOD effect number, and for each
+** extended effect (14) by the high nibble of its argument.
+** SSS_EFFECT_NONE for those that aren't supported. */
+static const BYTE effects[16] =
 {
-    char                    name[22];       /* Text name of instrument. */
-    unsigned short int      length;         /* # words of instrument data. */
-    unsigned char           fine_tune;      /* -8..+8 fine tuning of instrument. */
-    unsigned char           volume;         /* Loudness 0..64 */
-    unsigned short int      repeat_start;   /* Offset where repetition starts. */
-    unsigned short int      repeat_length;  /* Length of repetition. */
-} INST_HEADER;
-
-/* Header of 31-instrument MOD file. */
-typedef struct
+    SSS_EFFECT_ARPEGGIO,        /* 0 */
+    SSS_EFFECT_SLIDE_UP,        /* 1 */
+    SSS_EFFECT_SLIDE_DOWN,      /* 2 */
+    SSS_EFFECT_SLIDE_TO_NOTE,   /* 3 */
+    SSS_EFFECT_VIBRATO,         /* 4 */
+    SSS_EFFECT_NONE,            /* 5 = slide to note and volume slide */
+    SSS_EFFECT_NONE,            /* 6 = vibrato and volume slide */
+    SSS_EFFECT_NONE,            /* 7 = tremolo */
+    SSS_EFFECT_NONE,            /* 8 */
+    SSS_EFFECT_SAMPLE_OFFSET,   /* 9 */
+    SSS_EFFECT_VOLUME_SLIDE,    /* 10 */
+    SSS_EFFECT_JUMP,            /* 11 */
+    SSS_EFFECT_SET_VOLUME,      /* 12 */
+    SSS_EFFECT_PATTERN_BREAK,   /* 13 */
+    SSS_EFFECT_NONE,            /* 14 = extended; see below */
+    SSS_EFFECT_SET_TEMPO        /* 15 */
+};
+static const BYTE extended_effects[16] =
 {
-    char            name[20];       /* Text name of song. */
-    INST_HEADER     inst[31];       /* Information about each instrument. */
-    unsigned char   num_pats;       /* Number of patterns to play. */
-    unsigned char   ciaa_speed;     /* Amiga-specific. */
-    unsigned char   pat_order[128]; /* Order in which patterns are played. */
-    unsigned char   signature[4];   /* "M.K." or "FLT4". */
-} MOD_HEADER;
-
-/* Header of old 15-instrument MOD file. */
+    SSS_EFFECT_NONE,            /* 0 = filter */
+    SSS_EFFECT_NONE,            /* 1 = fine slide up */
+    SSS_EFFECT_NONE,            /* 2 = fine slide down */
+    SSS_EFFECT_NONE,            /* 3 = glissando */
+    SSS_EFFECT_NONE,            /* 4 = vibrato waveform */
+    SSS_EFFECT_NONE,            /* 5 = set finetune */
+    SSS_EFFECT_PATTERN_LOOP,    /* 6 */
+    SSS_EFFECT_NONE,            /* 7 = tremolo waveform */
+    SSS_EFFECT_NONE,            /* 8 */
+    SSS_EFFECT_RETRIGGER,       /* 9 */
+    SSS_EFFECT_NONE,            /* 10 = fine volume slide up */
+    SSS_EFFECT_NONE,            /* 11 = fine volume slide down */
+    SSS_EFFECT_NOTE_CUT,        /* 12 */
+    SSS_EFFECT_NOTE_DELAY,      /* 13 */
+    SSS_EFFECT_PATTERN_DELAY,   /* 14 */
+    SSS_EFFECT_NONE             /* 15 = invert loop */
+};
+
+/* The bytes of a MOD file being loaded.  The parser reads
+** them only through span_at(), so that nothing is read past
+** the end of them. */
 typedef struct
 {
-    char            name[20];       /* Text name of song. */
-    INST_HEADER     inst[15];       /* Information about each instrument. */
-    unsigned char   num_pats;       /* Number of patterns to play. */
-    unsigned char   ciaa_speed;     /* Amiga-specific. */
-    unsigned char   pat_order[128]; /* Order in which patterns are played. */
-} OLD_MOD_HEADER;
+    const BYTE      *data;          /* First byte of file. */
+    DWORD           size;           /* Size of file in bytes. */
+    LPVOID          view;           /* Mapped view of the file that */
+                                    /* the samples can play from, */
+                                    /* or NULL to copy them. */
+    BOOL            kept;           /* Set once the song has been */
+                                    /* handed 'view', and will */
+                                    /* unmap it. */
+    SSS_LOAD_TIMES  times;          /* How long each phase of */
+                                    /* this load took. */
+    LARGE_INTEGER   mark;           /* Performance counter reading */
+                                    /* at the end of the last phase. */
+} MOD_SPAN;
+
+/* How long each phase of the last load took.  Each load keeps
+** its own times in its MOD_SPAN, and copies them here when it
+** is over, so loads on other threads don't mix them up. */
+static SSS_LOAD_TIMES   load_times;
 
-#pragma pack()
+/************************* LOCAL FUNCTIONS ************************/
 
-/* Header data from MOD file. */
-static MOD_HEADER       hdr31;
-static OLD_MOD_HEADER   hdr15;
+/*
+** Returns the microseconds since the end of the last phase
+** of loading 'span', and starts the next phase.
+*/
+static DWORD phase_time(MOD_SPAN *span)
+{
+    LARGE_INTEGER   now;
+    LARGE_INTEGER   freq;
+    DWORD           us;
+
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    us = (DWORD)((ULONGLONG)(now.QuadPart - span->mark.QuadPart) *
+                1000000 / (ULONGLONG)freq.QuadPart);
+    span->mark = now;
+    return us;
+}
 
-/* Temporary storage for a pattern from MOD file. */
-static PATTERN_DESC     modpattern;
+/*
+** Returns a pointer to 'n' bytes at offset 'pos' in the
+** MOD file, or NULL if the file ends before them.
+*/
+static const BYTE *span_at(const MOD_SPAN *span, DWORD pos, DWORD n)
+{
+    if (pos > span->size || n > span->size - pos)
+        return NULL;
+    return span->data + pos;
+}
 
-/************************* LOCAL FUNCTIONS ************************/
+/*
+** Returns the big-endian 16-bit word at 'p'.
+*/
+static UINT word_at(const BYTE *p)
+{
+    return ((UINT)p[0] << 8) | p[1];
+}
 
 /*
-** Swaps the two bytes of a 16-bit word.
+** Adds a sample of the MOD file to the samples list:  one
+** that plays straight from the file if the song has been
+** handed its mapped view, or else a copy, since the view
+** is unmapped after loading otherwise.  Returns as
+** sss_sample_add() does.
 */
-static void byteswap(unsigned short int *w)
+static UINT span_sample(const MOD_SPAN *span, const BYTE *data,
+        UINT size, UINT loopbeg, UINT loopsiz)
 {
-    *w = (((*w) << 8) & 0xFF00) + (((*w) >> 8) & 0xFF);
+    if (span->kept)
+        return sss_sample_add_ref((LPCSTR)data, size, loopbeg, loopsiz,
+                        MOD_RECORDED_RATE);
+    return sss_sample_add((LPSTR)data, size, loopbeg, loopsiz,
+                        MOD_RECORDED_RATE, 0);
 }
 
 /*
-** load15:
-** Loads an old-style 15-instrument MOD file.
+** find_layout:
+** Works out which layout a MOD file has, from its signature.
 **
 ** Parameters:
 **      Name    Description
 **      ----    -----------
-**      fh      File handle of input file.
+**      span    The bytes of the file.
+**      layout  Where to put the layout, with its number of
+**              channels filled in.
+**
+** Returns:
+**      Value   Meaning
+**      -----   -------
+**      TRUE    Successful.
+**      FALSE   The signature gives a number of channels
+**              that can't be played.
+*/
+static BOOL find_layout(const MOD_SPAN *span, MOD_LAYOUT *layout)
+{
+    const BYTE  *sig;   /* Where a 31-instrument file's signature is. */
+    const char  *match; /* Signature being matched. */
+    UINT        nchannels;
+    UINT        u;
+    UINT        v;
+
+    sig = span_at(span, MOD_NAME_SIZE + 31 * MOD_INST_SIZE + 2 +
+                MOD_ORDER_SIZE, MOD_SIGNATURE_SIZE);
+    nchannels = 0;
+    for (u = 0; u < NUM_LAYOUTS - 1 && sig != NULL; u++)
+    {
+        /* Compare the signature, collecting any digits. */
+        match = layouts[u].signature;
+        nchannels = 0;
+        for (v = 0; v < MOD_SIGNATURE_SIZE; v++)
+        {
+            if (match[v] == '#' && sig[v] >= '0' && sig[v] <= '9')
+                nchannels = nchannels * 10 + (sig[v] - '0');
+            else if ((BYTE)match[v] != sig[v])
+                break;
+        }
+        if (v == MOD_SIGNATURE_SIZE)
+            break;
+    }
+
+    *layout = layouts[u];
+    if (layout->nchannels == 0)
+        layout->nchannels = nchannels;
+    return layout->nchannels >= 1 &&
+           layout->nchannels <= SSS_MAX_MUSIC_CHANNELS;
+}
+
+/*
+** decode_patterns:
+** Defines the steps of all of the patterns of a MOD file,
+** in one pass through the pattern data.  A note given
+** without an instrument plays the last instrument given
+** on its channel, as the Amiga players do.  Steps with
+** more channels than a SSS_STEP_DESC holds are defined
+** a part at a time.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      note    Pointer to first note of first pattern.
+**      npats   Number of patterns.
+**      layout  Layout of file.
 **
 ** Returns:
 **      See SSSERR_... constants in sss.h
 */
-UINT load15(int fh)
+static UINT decode_patterns(const BYTE *note, UINT npats,
+        const MOD_LAYOUT *layout)
 {
-    OLD_MOD_HEADER  *hdr = &hdr15;
-    UINT            u;
-    long            filesize;
-    long            ltmp;
-    UINT            npats;
     UINT            ipat;
     UINT            istep;
-    UINT            isample;
-    LPSTR           smpdata;
-    UINT            hsmp;
     UINT            ichannel;
-    SSS_STEP_DESC   dstep;
-    NOTE_DESC       modnote;
+    UINT            first;      /* First channel of part of step. */
+    UINT            end;        /* Channel after the part. */
+    UINT            k;          /* Index of channel in part. */
     UINT            instrument;
     UINT            pitch;
+    UINT            type;       /* MOD effect number. */
+    UINT            param;      /* Its argument. */
+    UINT            effect;     /* SSS_EFFECT_... for it. */
+    UINT            result;
+    SSS_STEP_DESC   dstep;
+
+    for (ipat = 0; ipat < npats; ipat++)
+    {
+        for (istep = 0; istep < MOD_PATTERN_STEPS; istep++)
+        {
+            for (first = 0; first < layout->nchannels; first = end)
+            {
+                end = first + SSS_MUSIC_CHANNELS;
+                if (end > layout->nchannels)
+                    end = layout->nchannels;
+                memset(&dstep, 0, sizeof(dstep));
+                for (ichannel = first; ichannel < end;
+                        ichannel++, note += MOD_NOTE_SIZE)
+                {
+                    /* Get note play data.  A note without an
+                    ** instrument, or with one the file doesn't have,
+                    ** plays the channel's last one; which that is
+                    ** depends on the order the patterns are played
+                    ** in, so it's left to the player.  An instrument
+                    ** without a note still sets the volume. */
+                    k = ichannel - first;
+                    instrument = (note[0] & 0xF0) | (note[2] >> 4);
+                    pitch = ((note[0] & 0x0F) << 8) | note[1];
+                    dstep.note_pitch[k] = pitch;
+                    if (instrument == 0 || instrument > layout->ninst)
+                        dstep.note_sample[k] = SSS_NO_SAMPLE;
+                    else if (pitch == 0)
+                        dstep.note_sample[k] = (instrument - 1) |
+                                SSS_SAMPLE_ONLY;
+                    else
+                        dstep.note_sample[k] = instrument - 1;
+
+                    /* Get effect data. */
+                    type = note[2] & 0x0F;
+                    param = note[3];
+                    if (type == 14)
+                    {
+                        /* Extended effect, by the high nibble. */
+                        effect = extended_effects[param >> 4];
+                        param &= 0x0F;
+                    }
+                    else
+                    {
+                        effect = effects[type];
+                        if (type == 13)
+                        {
+                            /* Step to break to is in decimal digits. */
+                            param = (param >> 4) * 10 + (param & 0x0F);
+                        }
+                        else if (type == 0 && param == 0)
+                        {
+                            /* No arpeggio; no effect at all. */
+                            effect = SSS_EFFECT_NONE;
+                        }
+                    }
+                    if (effect != SSS_EFFECT_NONE)
+                    {
+                        dstep.note_effect[k] = effect;
+                        dstep.note_eparam[k] = param;
+                    }
+                }
+                result = sss_music_define_step_part(ipat, istep, first,
+                                &dstep);
+                if (result != SSSERR_OK)
+                    return result;
+            }
+        }
+    }
 
-    /* Determine file size. */
-    filesize = _llseek(fh, 0L, 2);
-    _llseek(fh, 0L, 0);
+    return SSSERR_OK;
+}
 
-    /* Read the header. */
-    if (_lread(fh, hdr, sizeof(hdr15)) != sizeof(hdr15))
+/*
+** load_span:
+** Loads a MOD file of any layout from its bytes, and times
+** each phase of it.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      span    The bytes of the file.
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+static UINT load_span(MOD_SPAN *span)
+{
+    MOD_LAYOUT      layout;
+    const BYTE      *hdr;       /* Header of file. */
+    const BYTE      *inst;      /* Description of an instrument. */
+    const BYTE      *order;     /* Number of orders, then order list. */
+    const BYTE      *data;      /* Pattern or sample data. */
+    DWORD           hdrsize;    /* Size of header. */
+    DWORD           patsize;    /* Size of each pattern. */
+    DWORD           smpsize;    /* Size of all sample data. */
+    DWORD           pos;
+    UINT            npats;
+    UINT            norder;
+    UINT            u;
+    UINT            size;
+    UINT            loopbeg;
+    UINT            loopsiz;
+    UINT            hsmp;
+    UINT            result;
+
+    /* Find the header, which is laid out as the signature says. */
+    if (!find_layout(span, &layout))
     {
-        /* Failed reading from file. */
-        _lclose(fh);
+        /* Too many channels. */
         return SSSERR_READ_FILE;
     }
-
-    /* Do byte swapping on integer fields in instrument descriptors. */
-    for (u = 0; u < 15; u++)
+    hdrsize = MOD_NAME_SIZE + layout.ninst * MOD_INST_SIZE + 2 +
+                MOD_ORDER_SIZE +
+                (layout.signature != NULL ? MOD_SIGNATURE_SIZE : 0);
+    hdr = span_at(span, 0, hdrsize);
+    if (hdr == NULL)
     {
-        byteswap(&hdr->inst[u].length);
-        byteswap(&hdr->inst[u].repeat_start);
-        byteswap(&hdr->inst[u].repeat_length);
-        hdr->inst[u].name[21] = '\0';
-        if (hdr->inst[u].repeat_length < 3)
-            hdr->inst[u].repeat_length = 0;
+        /* File is too short. */
+        return SSSERR_READ_FILE;
     }
-
-    /* Calculate number of patterns in MOD file. */
-    ltmp = filesize - sizeof(OLD_MOD_HEADER);
-    for (u = 0; u < 15; u++)
-        ltmp -= (long)hdr->inst[u].length * 2;
-    npats = (UINT)(ltmp / sizeof(PATTERN_DESC));
+    order = hdr + MOD_NAME_SIZE + layout.ninst * MOD_INST_SIZE;
+
+    /* Calculate number of patterns in MOD file, from the space
+    ** that's left after the header and the samples. */
+    smpsize = 0;
+    for (u = 0; u < layout.ninst; u++)
+        smpsize += word_at(hdr + MOD_NAME_SIZE + u * MOD_INST_SIZE + 22) * 2;
+    patsize = MOD_PATTERN_STEPS * layout.nchannels * MOD_NOTE_SIZE;
+    if (span->size - hdrsize < smpsize + patsize)
+    {
+        /* File is too short to hold its samples. */
+        return SSSERR_READ_FILE;
+    }
+    npats = (span->size - hdrsize - smpsize) / patsize;
+    norder = order[0];
+    if (norder > MOD_ORDER_SIZE)
+        norder = MOD_ORDER_SIZE;
 
     /* Start creation of song. */
-    if (sss_music_create(npats, hdr->num_pats, 15) != SSSERR_OK)
+    if (sss_music_create(npats, norder, layout.ninst) != SSSERR_OK)
     {
         return SSSERR_NO_MEMORY;
     }
-    for (ipat = 0; ipat < npats; ipat++)
+    if (span->view != NULL)
+        span->kept = sss_music_define_view(span->view) == SSSERR_OK;
+    sss_music_define_channels(layout.nchannels);
+    for (u = 0; u < npats; u++)
     {
-        if (sss_music_define_pattern(ipat, 64) != SSSERR_OK)
+        if (sss_music_define_pattern(u, MOD_PATTERN_STEPS) != SSSERR_OK)
             return SSSERR_NO_MEMORY;
     }
-    for (u = 0; u < hdr->num_pats; u++)
+    for (u = 0; u < norder; u++)
     {
-        sss_music_define_order(u, hdr->pat_order[u]);
-    }
-
-    /* Process each pattern in the file. */
-    for (ipat = 0; ipat < npats; ipat++)
-    {
-        /* Read pattern from file. */
-        if (_lread(fh, &modpattern, sizeof(modpattern)) != sizeof(modpattern))
-        {
-            return SSSERR_READ_FILE;
-        }
-
-        /* Process the steps in the pattern. */
-        for (istep = 0; istep < 64; istep++)
-        {
-            /* Process each channel for this step. */
-            memset(&dstep, 0, sizeof(dstep));
-            for (ichannel = 0; ichannel < 4; ichannel++)
-            {
-                /* Get note play data. */
-                modnote = modpattern.notes[ichannel + istep * NUM_TRACKS];
-                instrument = ((UINT)modnote.b3 / 16) & 0x0F;
-                pitch = ((UINT)modnote.b1 * 256) + (UINT)modnote.b2;
-                pitch *= PITCH_SCALE;
-                if (instrument > 0 && pitch > 0)
-                {
-                    dstep.note_pitch[ichannel] = pitch;
-                    dstep.note_sample[ichannel] = instrument - 1;
-                }
-
-                /* Get effect data. */
-                switch(modnote.b3 & 0x0F)
-                {
-                    case 11: /* Position jump */
-                        dstep.note_effect[ichannel] = SSS_EFFECT_JUMP;
-                        dstep.note_eparam[ichannel] = (UINT)modnote.b4;
-                        break;
-
-                    case 12: /* Set volume */
-                        dstep.note_effect[ichannel] = SSS_EFFECT_SET_VOLUME;
-                        dstep.note_eparam[ichannel] = (UINT)modnote.b4;
-                        break;
-
-                    case 13: /* Pattern break */
-                        dstep.note_effect[ichannel] = SSS_EFFECT_PATTERN_BREAK;
-                        break;
-
-                    case 15: /* Set speed */
-                        dstep.note_effect[ichannel] = SSS_EFFECT_SET_TEMPO;
-                        dstep.note_eparam[ichannel] = (UINT)modnote.b4;
-                        break;
-
-                    case 0: /* Arpeggiation */
-                    case 1: /* Slide up */
-                    case 2: /* Slide down */
-                    case 3: /* Slide to note */
-                    case 4: /* Vibrato */
-                    case 10: /* Volume slide */
-                        /* NOT IMPLEMENTED YET */
-                        break;
-
-                    default:
-                        ; /* Unsupported */
-                }
-            }
-            sss_music_define_step(ipat, istep, &dstep);
-        }
+        sss_music_define_order(u, order[2 + u]);
     }
+    span->times.header = phase_time(span);
+    if (sss_music_load_cancelled())
+        return SSSERR_CANCELLED;
+
+    /* Decode all of the patterns. */
+    pos = hdrsize;
+    data = span_at(span, pos, npats * patsize);
+    if (data == NULL)
+        return SSSERR_READ_FILE;
+    result = decode_patterns(data, npats, &layout);
+    if (result != SSSERR_OK)
+        return result;
+    pos += npats * patsize;
+    span->times.patterns = phase_time(span);
+    if (sss_music_load_cancelled())
+        return SSSERR_CANCELLED;
 
     /* Load the samples. */
-    for (isample = 0; isample < 15; isample++)
+    for (u = 0; u < layout.ninst; u++)
     {
-        /* Allocate temporary memory for sample data. */
-        smpdata = malloc(hdr->inst[isample].length * 2);
-        if (smpdata == NULL)
-        {
-            return SSSERR_NO_MEMORY;
-        }
-
-        /* Load the sample data. */
-        if (_lread(fh, smpdata, hdr->inst[isample].length * 2) !=
-                                (unsigned)hdr->inst[isample].length * 2)
+        inst = hdr + MOD_NAME_SIZE + u * MOD_INST_SIZE;
+        size = word_at(inst + 22) * 2;
+        loopbeg = word_at(inst + 26) * 2;
+        loopsiz = word_at(inst + 28) * 2;
+        if (loopsiz < 6)
+            loopsiz = 0;
+
+        /* Find the sample data in the file. */
+        data = span_at(span, pos, size);
+        if (data == NULL)
         {
-            free(smpdata);
             return SSSERR_READ_FILE;
         }
+        pos += size;
 
         /* Define the sample. */
-        hsmp = sss_sample_add(smpdata,
-                        hdr->inst[isample].length * 2,
-                        hdr->inst[isample].repeat_start * 2,
-                        hdr->inst[isample].repeat_length * 2,
-                        MOD_RECORDED_RATE, 0);
+        hsmp = span_sample(span, data, size, loopbeg, loopsiz);
         if (hsmp >= SSS_MAX_SAMPLES)
         {
-            free(smpdata);
             return hsmp;
         }
-        sss_music_define_sample(isample, hsmp);
+        sss_music_define_sample(u, hsmp);
+        sss_music_define_finetune(u, (inst[24] & 0x07) - (inst[24] & 0x08));
+        sss_music_define_volume(u, (inst[25] < SSS_MAX_VOLUME) ?
+                        inst[25] : SSS_MAX_VOLUME - 1);
+    }
+    span->times.samples = phase_time(span);
 
-        /* Discard temporary sample buffer. */
-        free(smpdata);
+    /* Set initial pan positions for MOD:  left, right, right,
+    ** left, and the same again for any more channels. */
+    for (u = 0; u < layout.nchannels; u++)
+    {
+        sss_music_define_pan(u, (u % 4 == 0 || u % 4 == 3) ?
+                        SSS_PAN_LEFT : SSS_PAN_RIGHT);
     }
 
     return SSSERR_OK;
 }
 
 /*
-** load31:
-** Loads a 31-instrument MOD file.
+** load_mod:
+** Loads a MOD file from its bytes, cleaning up if that fails,
+** and publishes how long it took.
 **
 ** Parameters:
 **      Name    Description
 **      ----    -----------
-**      fh      File handle of input file.
+**      span    The bytes of the file.
 **
 ** Returns:
 **      See SSSERR_... constants in sss.h
 */
-UINT load31(int fh)
+static UINT load_mod(MOD_SPAN *span)
 {
-    MOD_HEADER      *hdr = &hdr31;
-    UINT            u;
-    long            filesize;
-    long            ltmp;
-    UINT            npats;
-    UINT            ipat;
-    UINT            istep;
-    UINT            isample;
-    LPSTR           smpdata;
-    UINT            hsmp;
-    UINT            ichannel;
-    SSS_STEP_DESC   dstep;
-    NOTE_DESC       modnote;
-    UINT            instrument;
-    UINT            pitch;
-
-    /* Determine file size. */
-    filesize = _llseek(fh, 0L, 2);
-    _llseek(fh, 0L, 0);
+    UINT    result;
 
-    /* Read the header. */
-    if (_lread(fh, hdr, sizeof(hdr31)) != sizeof(hdr31))
+    result = load_span(span);
+    span->times.total = span->times.open + span->times.header +
+                span->times.patterns + span->times.samples;
+    if (result != SSSERR_OK)
     {
-        /* Failed reading from file. */
-        _lclose(fh);
-        return SSSERR_READ_FILE;
+        /* Failed loading file. */
+        sss_music_flush();
     }
+    load_times = span->times;
 
-    /* Do byte swapping on integer fields in instrument descriptors. */
-    for (u = 0; u < 31; u++)
-    {
-        byteswap(&hdr->inst[u].length);
-        byteswap(&hdr->inst[u].repeat_start);
-        byteswap(&hdr->inst[u].repeat_length);
-        hdr->inst[u].name[21] = '\0';
-        if (hdr->inst[u].repeat_length < 3)
-            hdr->inst[u].repeat_length = 0;
-    }
+    return result;
+}
 
-    /* Calculate number of patterns in MOD file. */
-    ltmp = filesize - sizeof(MOD_HEADER);
-    for (u = 0; u < 31; u++)
-        ltmp -= (long)hdr->inst[u].length * 2;
-    npats = (UINT)(ltmp / sizeof(PATTERN_DESC));
+/*
+** open_span:
+** Opens a MOD file, and maps it into memory, all at once, so
+** that the samples can be played from the file's pages
+** instead of copies of them.  The view outlives both handles.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      fn      Pathname of file to open.
+**      span    Filled in with the bytes of the file.
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+static UINT open_span(LPSTR fn, MOD_SPAN *span)
+{
+    HANDLE      hfile;  /* Handle to input file. */
+    HANDLE      hmap;   /* Handle to mapping of input file. */
 
-    /* Start creation of song. */
-    if (sss_music_create(npats, hdr->num_pats, 31) != SSSERR_OK)
-    {
-        return SSSERR_NO_MEMORY;
-    }
-    for (ipat = 0; ipat < npats; ipat++)
+    /* Open the input file. */
+    hfile = CreateFile(fn, GENERIC_READ, FILE_SHARE_READ, NULL,
+                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hfile == INVALID_HANDLE_VALUE)
     {
-        if (sss_music_define_pattern(ipat, 64) != SSSERR_OK)
-            return SSSERR_NO_MEMORY;
+        /* Failed opening file. */
+        return SSSERR_OPEN_FILE;
     }
-    for (u = 0; u < hdr->num_pats; u++)
+
+    /* Map it into memory. */
+    span->size = GetFileSize(hfile, NULL);
+    if (span->size == INVALID_FILE_SIZE || span->size == 0)
     {
-        sss_music_define_order(u, hdr->pat_order[u]);
+        /* File is too short. */
+        CloseHandle(hfile);
+        return SSSERR_READ_FILE;
     }
-
-    /* Process each pattern in the file. */
-    for (ipat = 0; ipat < npats; ipat++)
+    hmap = CreateFileMapping(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hfile);
+    if (hmap == NULL)
     {
-        /* Read pattern from file. */
-        if (_lread(fh, &modpattern, sizeof(modpattern)) != sizeof(modpattern))
-        {
-            return SSSERR_READ_FILE;
-        }
-
-        /* Process the steps in the pattern. */
-        for (istep = 0; istep < 64; istep++)
-        {
-            /* Process each channel for this step. */
-            memset(&dstep, 0, sizeof(dstep));
-            for (ichannel = 0; ichannel < 4; ichannel++)
-            {
-                /* Get note data. */
-                modnote = modpattern.notes[ichannel + istep * NUM_TRACKS];
-                instrument =
-                        ((UINT)modnote.b1 & 0xF0) +
-                        (((UINT)modnote.b3 / 16) & 0x0F);
-                pitch = (((UINT)modnote.b1 & 0x0F) * 256) +
-                                (UINT)modnote.b2;
-                pitch *= PITCH_SCALE;
-                if (instrument > 0 && pitch > 0)
-                {
-                    dstep.note_pitch[ichannel] = pitch;
-                    dstep.note_sample[ichannel] = instrument - 1;
-                }
-
-                /* Get effect data. */
-                switch(modnote.b3 & 0x0F)
-                {
-                    case 11: /* Position jump */
-                        dstep.note_effect[ichannel] = SSS_EFFECT_JUMP;
-                        dstep.note_eparam[ichannel] = (UINT)modnote.b4;
-                        break;
-
-                    case 12: /* Set volume */
-                        dstep.note_effect[ichannel] = SSS_EFFECT_SET_VOLUME;
-                        dstep.note_eparam[ichannel] = (UINT)modnote.b4;
-                        break;
-
-                    case 13: /* Pattern break */
-                        dstep.note_effect[ichannel] = SSS_EFFECT_PATTERN_BREAK;
-                        break;
-
-                    case 15: /* Set speed */
-                        dstep.note_effect[ichannel] = SSS_EFFECT_SET_TEMPO;
-                        dstep.note_eparam[ichannel] = (UINT)modnote.b4;
-                        break;
-
-                    case 0: /* Arpeggiation */
-                    case 1: /* Slide up */
-                    case 2: /* Slide down */
-                    case 3: /* Slide to note */
-                    case 4: /* Vibrato */
-                    case 10: /* Volume slide */
-                        /* NOT IMPLEMENTED YET */
-                        break;
-
-                    default:
-                        ; /* Unsupported */
-                }
-            }
-            sss_music_define_step(ipat, istep, &dstep);
-        }
+        /* Failed mapping file. */
+        return SSSERR_READ_FILE;
     }
-
-    /* Load the samples. */
-    for (isample = 0; isample < 31; isample++)
+    span->view = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hmap);
+    if (span->view == NULL)
     {
-        /* Allocate temporary memory for sample data. */
-        smpdata = malloc(hdr->inst[isample].length * 2);
-        if (smpdata == NULL)
-        {
-            return SSSERR_NO_MEMORY;
-        }
-
-        /* Load the sample data. */
-        if (_lread(fh, smpdata, hdr->inst[isample].length * 2) !=
-                                (unsigned)hdr->inst[isample].length * 2)
-        {
-            free(smpdata);
-            return SSSERR_READ_FILE;
-        }
-
-        /* Define the sample. */
-        hsmp = sss_sample_add(smpdata,
-                        hdr->inst[isample].length * 2,
-                        hdr->inst[isample].repeat_start * 2,
-                        hdr->inst[isample].repeat_length * 2,
-                        MOD_RECORDED_RATE, 0);
-        if (hsmp >= SSS_MAX_SAMPLES)
-        {
-            free(smpdata);
-            return hsmp;
-        }
-        sss_music_define_sample(isample, hsmp);
-
-        /* Discard temporary sample buffer. */
-        free(smpdata);
+        /* Failed mapping file. */
+        return SSSERR_READ_FILE;
     }
+    span->data = span->view;
+    span->kept = FALSE;
 
     return SSSERR_OK;
 }
@@ -618,68 +755,79 @@ UINT load31(int fh)
 UINT
 sss_music_load_mod(LPSTR fn)
 {
-    int     fh;     /* File handle to input file. */
-    UINT    result;
+    MOD_SPAN    span;
+    UINT        result;
+
+    memset(&span, 0, sizeof(span));
+    phase_time(&span);
 
     /* Open the input file. */
-    fh = _lopen(fn, OF_READ);
-    if (fh < 0)
+    result = open_span(fn, &span);
+    if (result != SSSERR_OK)
     {
-        /* Failed opening file. */
-        return SSSERR_OPEN_FILE;
+        /* Nothing was loaded, so nothing took any time. */
+        load_times = span.times;
+        return result;
     }
+    span.times.open = phase_time(&span);
 
-    /* Read the header. */
-    if (_lread(fh, &hdr31, sizeof(hdr31)) != sizeof(hdr31))
-    {
-        /* Failed reading from file. */
-        _lclose(fh);
-        return SSSERR_READ_FILE;
-    }
-    _llseek(fh, 0L, 0);
+    /* Once the song has the view, unmapping is up to it. */
+    result = load_mod(&span);
+    if (!span.kept)
+        UnmapViewOfFile(span.view);
 
-    /* Determine if it's a 15-instrument or 31-instrument MOD file. */
-    if (strncmp((const char *)hdr31.signature, MOD_SIGNATURE1, strlen(MOD_SIGNATURE1)) != 0 &&
-            strncmp((const char *)hdr31.signature, MOD_SIGNATURE2, strlen(MOD_SIGNATURE2)) != 0)
-    {
-        /*
-        ** It's probably an old-style 15-instrument MOD file.
-        */
+    return result;
+}
 
-        result = load15(fh);
-        if (result != SSSERR_OK)
-        {
-            /* Failed loading file. */
-            _lclose(fh);
-            sss_music_flush();
-            return result;
-        }
-    }
-    else
-    {
-        /*
-        ** It's probably a 31-instrument MOD file.
-        */
+/*
+** sss_music_load_mod_mem:
+** Loads a MOD type music file from memory.  The song keeps
+** copies of the samples, so the caller may free the data
+** as soon as this returns.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      data    Pointer to the bytes of the file.
+**      len     Size of the file in bytes.
+**
+** Returns:
+**      See SSSERR_... constants in sss.h
+*/
+UINT
+sss_music_load_mod_mem(const void *data, size_t len)
+{
+    MOD_SPAN    span;
 
-        result = load31(fh);
-        if (result != SSSERR_OK)
-        {
-            /* Failed loading file. */
-            _lclose(fh);
-            sss_music_flush();
-            return result;
-        }
-    }
+    if (data == NULL || (DWORD)len != len)
+        return SSSERR_BAD_PARAM;
 
-    /* Close the input file. */
-    _lclose(fh);
+    memset(&span, 0, sizeof(span));
+    phase_time(&span);
 
-    /* Set initial pan positions for MOD. */
-    sss_music_define_pan(0, SSS_PAN_LEFT);
-    sss_music_define_pan(1, SSS_PAN_RIGHT);
-    sss_music_define_pan(2, SSS_PAN_RIGHT);
-    sss_music_define_pan(3, SSS_PAN_LEFT);
+    span.data = data;
+    span.size = (DWORD)len;
+    span.view = NULL;
+    span.kept = FALSE;
 
-    return SSSERR_OK;
+    return load_mod(&span);
 }
 
+/*
+** sss_music_get_load_times:
+** Retrieves how long each phase of the last MOD load took,
+** whether it succeeded or not.
+**
+** Parameters:
+**      Name    Description
+**      ----    -----------
+**      times   Pointer to struct to fill in.
+**
+** Returns:
+**      NONE
+*/
+void
+sss_music_get_load_times(SSS_LOAD_TIMES *times)
+{
+    *times = load_times;
+}
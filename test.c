@@ -56,6 +56,9 @@ DAMAGE.  IN OTHER WORDS, USE AT YOUR OWN RISK, NOT OURS.
 
 int main(int argc, char **argv)
 {
+    SSS_SONG_INFO   info;
+    SSS_LOAD_TIMES  times;
+
     if (argc != 2)
     {
         printf("Usage:  test filename.MOD\n");
@@ -76,6 +79,21 @@ int main(int argc, char **argv)
         sss_deinit();
         return 1;
     }
+    sss_music_get_load_times(&times);
+    printf("Loaded in %lu us (open %lu, header %lu, patterns %lu, "
+            "samples %lu).\n", times.total, times.open, times.header,
+            times.patterns, times.samples);
+
+    if (sss_music_analyze(&info) == SSSERR_OK)
+    {
+        printf("Length %lu:%02lu, %u of %u orders played",
+                info.length / 60000, info.length / 1000 % 60,
+                info.nreached, info.norder);
+        if (info.loops)
+            printf(", loops back to order %u step %u",
+                    info.loop_order, info.loop_step);
+        printf(".\n");
+    }
 
     printf("Playing.  Press a key to stop.\n");
     sss_music_command(SSS_CMD_MUSIC_PLAY);